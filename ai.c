@@ -1,249 +1,956 @@
-#include "ai.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitboard.h"
 #include "board.h"
+#include "ai.h"
+#include "bitbase.h"
+#include "trace.h"
+#include "tt.h"
+
+/* Files b through g of ranks 3 through 6, where minor pieces and pawns earn a
+ * bonus.  */
+#define CENTER_BB   0x00007e7e7e7e0000ULL
 
-extern int board[BOARD_SIZE]; /* From board.c.  */
-
-/* Search and evaluate AI's moves. MV->START_POS and MV->END_POS store AI's best
- * move.  */
-void best_move (struct move *mv)
-{
-    int legal_moves[BOARD_SIZE];
-    int curr_util = NEG_INF, i;
-
-    /* Generate legal moves for each black piece.  */
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if (board[i] < chp_null) {
-            init_moves_board (legal_moves);
-            gen_legal_moves (BPLAYER, i, legal_moves);
-
-            /* For each legal move, evaluate subsequent moves. If this move
-             * leads to current best score, save it.  */
-            int j;
-            for (j = 0; j < BOARD_SIZE; j++) {
-                if (legal_moves[j] == TRUE) {
-                    /* Make move and evaluate subsequent moves.  */
-                    int attacked_piece = move_piece (i, j);
-
-                    /* If the move wins the game, automatically make it.  */
-                    if (game_over () == TRUE) {
-                        mv->start_pos = i;
-                        mv->end_pos   = j;
-                        unmove_piece (i, j, attacked_piece);
-                        return;
-                    }
-
-                    /* Evaluate subsequent moves and choose the best one.  */
-                    int move_util = -1 * abp_search (WPLAYER, SEARCH_DEP - 1, 
-                        NEG_INF, POS_INF);
-                    unmove_piece (i, j, attacked_piece);
-
-                    /* If move is best yet, save it.  */
-                    if (move_util > curr_util) {
-                        mv->start_pos = i;
-                        mv->end_pos   = j;
-                        curr_util     = move_util;
-                    }
+/* Value of each piece type, indexed by white piece number.  */
+const int piece_values[7] = { 0, PAWN_VAL, KNIGHT_VAL, BISHOP_VAL, ROOK_VAL,
+    QUEEN_VAL, KING_VAL };
+
+/* Material value and piece-square bonus of each piece (indexed by piece value
+ * + 6) on each bitboard square, negated for white pieces. Board.c keeps
+ * running totals of both in each position's MATERIAL_TOTAL and PST_TOTAL as
+ * pieces move.  */
+int material_table[13];
+int pst_table[13][64];
+
+struct search_params search_params = { NULL_MOVE_R, NULL_MOVE_DEPTH,
+    LMR_DEPTH, LMR_MOVES, LMR_REDUCTION };
+
+/* Fill the evaluation tables. Must be called once at startup, before any
+ * position is set up.  */
+void init_eval ()
+{
+    int piece, sq;
+    for (piece = chp_bking; piece <= chp_wking; piece++) {
+        int type = PIECE_TYPE (piece);
+        int sign = (piece < 0) ? 1 : -1;
+        material_table[piece + 6] = sign * piece_values[type];
+
+        /* Pawns, knights and bishops earn a bonus in the center.  */
+        for (sq = 0; sq < 64; sq++) {
+            int bonus = 0;
+            if (CENTER_BB & SQ_BIT (sq)) {
+                if (type == chp_wknight || type == chp_wbishop) {
+                    bonus = 500;
+                } else if (type == chp_wpawn) {
+                    bonus = 200;
                 }
             }
+            pst_table[piece + 6][sq] = sign * bonus;
         }
     }
 }
 
-/* Alpha-beta pruning search.  */
-int abp_search (int player, int depth, int alpha, int beta)
-{
-    int legal_moves[BOARD_SIZE];
-    int curr_util = NEG_INF, i;
-    int mod = -1 * ((player == BPLAYER) ? -1 : 1);
-
-    /* For each piece on the board, generate its legal moves and evaluate
-     * its utility. Track the move with the greatest utility.  */
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if (board[i] > chp_null * mod) {
-            init_moves_board (legal_moves);
-            gen_plegal_moves (player, i, legal_moves);
-
-            int j;
-            for (j = 0; j < BOARD_SIZE; j++) {
-                if (legal_moves[j] == TRUE) {
-                    int attacked_piece = move_piece (i, j);
-                    int move_util = 0;
-
-                    /* If move wins the game, automatically make that move.  */
-                    if (game_over () == TRUE) {
-                        unmove_piece (i, j, attacked_piece);
-                        return (-1 * mod) * POS_INF;
-                    }
-
-                    /* If maximum depth reached evaluate the board. Else,
-                     * continue search.  */
-                    if (depth == 1) {
-                        move_util = mod * board_utility ();
-                    } else {
-                        move_util = mod * abp_search (opponent_player (player),
-                            depth - 1, -1 * beta, -1 * alpha);
-                    }
-                    
-                    /* If this move's utility is a new maximum, save it. Alter
-                     * alpha value and check against beta to potentially short
-                     * circuit the search.  */
-                    if (move_util > curr_util) {
-                        curr_util = move_util;
-                    }
-                    if (curr_util > alpha) {
-                        alpha = curr_util;
-                    }
-                    if (alpha >= beta) {
-                        unmove_piece (i, j, attacked_piece);
-                        return alpha;
-                    }
-                    
-                    unmove_piece (i, j, attacked_piece);
-                }
+/* Set the search parameter given by SETTING, written NAME=VALUE where NAME
+ * is a field of struct search_params. Returns FALSE if there's no such
+ * field or VALUE isn't a number from 0 to the field's MAX.  */
+int set_search_param (const char *setting)
+{
+    struct {
+        const char *name;
+        int        *value;
+        long        max;
+    } params[] = {
+        { "null_move_r",     &search_params.null_move_r,     MAX_DEPTH },
+        { "null_move_depth", &search_params.null_move_depth, MAX_DEPTH },
+        { "lmr_depth",       &search_params.lmr_depth,       MAX_DEPTH },
+        { "lmr_moves",       &search_params.lmr_moves,       MAX_MOVES },
+        { "lmr_reduction",   &search_params.lmr_reduction,   MAX_DEPTH }
+    };
+    const char *equals = strchr (setting, '=');
+    size_t length, i;
+    char *end;
+
+    if (equals == NULL) {
+        return FALSE;
+    }
+    length = equals - setting;
+    long value = strtol (equals + 1, &end, 10);
+    if (end == equals + 1 || *end != '\0' || value < 0) {
+        return FALSE;
+    }
+    for (i = 0; i < sizeof (params) / sizeof (params[0]); i++) {
+        if (strlen (params[i].name) == length
+            && strncmp (params[i].name, setting, length) == 0) {
+            if (value > params[i].max) {
+                return FALSE;
             }
+            *params[i].value = value;
+            return TRUE;
         }
     }
-    return curr_util;
+    return FALSE;
 }
 
-/* Return utility of BOARD as function of material and positional scores.  */
-int board_utility ()
+/* Return a millisecond timestamp for measuring search time.  */
+long get_time_ms ()
 {
-    return (MATERIAL_WT * material_score ())
-        + (POSITION_WT * positional_score ());
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
 }
 
-/* Return the material (piece) score of BOARD.  */
-int material_score ()
+/* Reset SEARCH's node count and start the clock for a search within LIMITS.
+ * SEARCH controls itself, and any helpers share its control.  */
+void init_search (struct search *search, struct search_limits *limits)
 {
-    int wt_pawn, wt_rook, wt_knight, wt_bishop, wt_queen, wt_king;
-    int bk_pawn, bk_rook, bk_knight, bk_bishop, bk_queen, bk_king;
-    wt_pawn = wt_rook = wt_knight = wt_bishop = wt_queen = wt_king = 0;
-    bk_pawn = bk_rook = bk_knight = bk_bishop = bk_queen = bk_king = 0;
+    init_thread_search (search);
+    search->control = &search->own_control;
+    search->control->stopped      = FALSE;
+    search->control->helper_nodes = 0;
+    search->control->start        = get_time_ms ();
+    search->control->stop_time    = (limits->time_ms > 0)
+        ? search->control->start + limits->time_ms : LONG_MAX;
+    search->control->max_nodes    = (limits->nodes > 0) ? limits->nodes
+        : LONG_MAX;
+    search->control->interrupt    = limits->interrupt;
+}
 
-    /* Get counts of each piece type for each player.  */
-    int i;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        switch (board[i]) {
-            case chp_wpawn:
-                wt_pawn++;
-                break;
-            case chp_wrook:
-                wt_rook++;
-                break;
-            case chp_wbishop:
-                wt_bishop++;
-                break;
-            case chp_wknight:
-                wt_knight++;
-                break;
-            case chp_wqueen:
-                wt_queen++;
-                break;
-            case chp_wking:
-                wt_king++;
-                break;
-            case chp_bpawn:
-                bk_pawn++;
-                break;
-            case chp_brook:
-                bk_rook++;
-                break;
-            case chp_bbishop:
-                bk_bishop++;
-                break;
-            case chp_bknight:
-                bk_knight++;
-                break;
-            case chp_bqueen:
-                bk_queen++;
-                break;
-            case chp_bking:
-                bk_king++;
-                break;
-            default:
-                break;
-        }
-    }
-
-    /* Material score is the number of each piece times it's value for each
-     * player, then subtract white's score from black's score.  */
-    return ((bk_pawn - wt_pawn) * PAWN_VAL) 
-        + ((bk_knight - wt_knight) * KNIGHT_VAL)
-        + ((bk_bishop - wt_bishop) * BISHOP_VAL)
-        + ((bk_rook - wt_rook) * ROOK_VAL)
-        + ((bk_queen - wt_queen) * QUEEN_VAL)
-        + ((bk_king - wt_king) * KING_VAL);
-}
-
-/* Return the positional utility of BOARD.  */
-int positional_score ()
-{
-    /* Sum of score of legal moves, attacks and defends by white pieces.  */
-    int white_score = 0, i;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if (board[i] == chp_wknight || board[i] == chp_wbishop) {
-            white_score += 2 * knight_pos_score (WPLAYER, i);
-        } else if (board[i] == chp_wpawn) {
-            white_score += knight_pos_score (WPLAYER, i);
-        }
-    }
-
-    /* Sum of score of legal moves, attacks and defends by black pieces.  */
-    int black_score = 0;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if (board[i] == chp_bknight || board[i] == chp_bbishop) {
-            black_score += 2 * knight_pos_score (BPLAYER, i);
-        } else if (board[i] == chp_bpawn) {
-            black_score += knight_pos_score (BPLAYER, i);
-        }
-    }
-
-    /* Increase score for pawns, knights and bishops in center of board.  */ 
-    for (i = 33; i < 82; i += 16) {
-        int j;
-        for (j = 0; j < 6; j++) {
-            if (board[i + j] == chp_bbishop || board[i + j] == chp_bknight) {
-                printf (":: EVAL: bk_bishop/knight in board center\n");
-                black_score += 500;
-            } else if (board[i + j] == chp_bpawn) {
-                printf (":: EVAL: bk_pawn in board center\n");
-                black_score += 200;
-            } else if (board[i + j] == chp_wbishop 
-                || board[i + j] == chp_wknight) {
-                printf (":: EVAL: wt_bishop/knight in board center\n");
-                white_score += 500;
-            } else if (board[i + j] == chp_wpawn) {
-                printf (":: EVAL: wt_pawn in board center\n");
-                white_score += 200;
+/* Reset SEARCH's statistics and killer moves for a new search.  */
+void init_thread_search (struct search *search)
+{
+    search->nodes = 0;
+    search->evals = 0;
+    search->beta_cutoffs = 0;
+    search->first_move_cutoffs = 0;
+    search->tt_probes = 0;
+    search->tt_hits = 0;
+    search->depth = 0;
+    search->branching = 0.0;
+    search->best_pv_length = 0;
+    search->follow_pv = FALSE;
+    memset (search->killers, 0, sizeof (search->killers));
+}
+
+/* Return the percentage of beta cutoffs in the last search that came from the
+ * first move searched.  */
+double cutoff_rate (struct search *search)
+{
+    if (search->beta_cutoffs == 0) {
+        return 0.0;
+    }
+    return 100.0 * search->first_move_cutoffs / search->beta_cutoffs;
+}
+
+/* Search and evaluate PLAYER's moves in SEARCH->POSITION within LIMITS.
+ * MV->START_POS and MV->END_POS store the best move, and its score for PLAYER
+ * is returned. Searches to depth 1, 2, 3... until LIMITS->DEPTH is reached or
+ * the time or nodes run out, keeping the best move of the deepest iteration
+ * that finished.
+ *
+ * With LIMITS->THREADS above 1 this is a Lazy SMP search: helper threads
+ * search the same root moves on their own copies of the position, half of
+ * them a ply ahead, and only help by filling the shared transposition table.
+ * They are stopped when this thread finishes. SEARCH->NODES afterwards
+ * counts the nodes of every thread.  */
+int best_move (struct search *search, int player, struct move *mv,
+    struct search_limits *limits)
+{
+    init_search (search, limits);
+    return run_search (search, player, mv, limits);
+}
+
+/* The search done by best_move, once init_search has set up SEARCH's control.
+ * Setting it up beforehand lets another thread stop the search, or change
+ * when it stops, as soon as it has been started.  */
+int run_search (struct search *search, int player, struct move *mv,
+    struct search_limits *limits)
+{
+    struct position *position = search->position;
+    int legal_moves[MAX_MOVES], scores[MAX_MOVES];
+    int max_depth = (limits->depth > 0) ? limits->depth : MAX_DEPTH;
+    int depth, score = 0, i;
+    struct helper_job helpers[MAX_THREADS];
+    struct position root;
+
+    /* Generate legal moves for each of PLAYER's pieces and put them in
+     * order, the move the transposition table remembers from an earlier
+     * search first.  */
+    int tt_move = 0, tt_score, tt_depth, tt_bound;
+    age_history (search);
+    tt_new_search ();
+    tt_probe (position->hash_key, &tt_move, &tt_score, &tt_depth, &tt_bound);
+    int count = gen_all_legal_moves (position, player, legal_moves);
+    score_moves (search, player, legal_moves, scores, count, tt_move, 0);
+    for (i = 0; i < count; i++) {
+        pick_move (legal_moves, scores, count, i);
+    }
+
+    /* Without a move PLAYER is checkmated or stalemated.  */
+    if (count == 0) {
+        return (player_in_check (position, player) == TRUE) ? NEG_INF : 0;
+    }
+    mv->start_pos = MOVE_START (legal_moves[0]);
+    mv->end_pos   = MOVE_END (legal_moves[0]);
+    mv->promotion = MOVE_PROMOTION (legal_moves[0]);
+
+    int threads = (limits->threads < MAX_THREADS) ? limits->threads
+        : MAX_THREADS;
+    root = *position;
+    for (i = 1; i < threads; i++) {
+        helpers[i].number    = i;
+        helpers[i].player    = player;
+        helpers[i].root      = &root;
+        helpers[i].control   = search->control;
+        helpers[i].count     = count;
+        helpers[i].max_depth = max_depth;
+        memcpy (helpers[i].moves, legal_moves, count * sizeof (int));
+        if (pthread_create (&helpers[i].id, NULL, helper_search,
+            &helpers[i]) != 0) {
+            break;
+        }
+    }
+    threads = (threads > 1) ? i : 1;
+
+    long last_nodes = 0, prev_nodes = 0;
+    for (depth = 1; depth <= max_depth; depth++) {
+        int util;
+        int best = aspiration_search (search, player, legal_moves, count,
+            depth, score, &util);
+        if (best >= 0) {
+            int move = legal_moves[best];
+            score = util;
+            mv->start_pos = MOVE_START (move);
+            mv->end_pos   = MOVE_END (move);
+            mv->promotion = MOVE_PROMOTION (move);
+            if (search->post == TRUE) {
+                post_thinking (search, depth, util);
             }
         }
+        if (control_stopped (search->control) == FALSE) {
+            search->depth = depth;
+            if (prev_nodes > 0) {
+                search->branching = (double) (search->nodes - last_nodes)
+                    / prev_nodes;
+            }
+            prev_nodes = search->nodes - last_nodes;
+            last_nodes = search->nodes;
+        }
+        TRACE (TRACE_SEARCH, "depth %d%s: %d - %d, %ld nodes, %ld ms", depth,
+            (control_stopped (search->control) == TRUE) ? " (stopped)" : "",
+            mv->start_pos, mv->end_pos, search->nodes,
+            get_time_ms () - search->control->start);
+        if (control_stopped (search->control) == TRUE) {
+            break;
+        }
+
+        /* Don't start an iteration that probably can't finish in the time
+         * left. Each one takes several times as long as the last.  */
+        long start = search->control->start;
+        long stop_time = control_stop_time (search->control);
+        if (stop_time != LONG_MAX
+            && get_time_ms () - start > (stop_time - start) / 2) {
+            break;
+        }
     }
 
-    return black_score - white_score;
+    stop_control (search->control);
+    for (i = 1; i < threads; i++) {
+        pthread_join (helpers[i].id, NULL);
+    }
+    search->nodes += search->control->helper_nodes;
+    return score;
 }
 
-/* Return position score for knight at START_POS owned by PLAYER.  */
-int knight_pos_score (int player, int start_pos)
+/* Thread body of a Lazy SMP helper: iteratively deepen on JOB's root moves
+ * until the main thread stops the search. Odd numbered helpers start a ply
+ * deeper, so the helpers aren't all searching the same tree at the same
+ * depth.  */
+void *helper_search (void *arg)
 {
-    int score = 0, legal_moves[BOARD_SIZE];
-    int mod   = (player == BPLAYER) ? -1 : 1;
-    init_moves_board (legal_moves);
-    gen_legal_moves (player, start_pos, legal_moves);
+    struct helper_job *job = arg;
+    struct position position = *job->root;
+    struct search helper, *search = &helper;
+    int depth, util;
 
+    memset (search, 0, sizeof (*search));
+    search->position = &position;
+    search->control  = job->control;
+    for (depth = 1 + (job->number & 1); depth <= job->max_depth; depth++) {
+        int best = search_root (search, job->player, job->moves, job->count,
+            depth, NEG_INF, POS_INF, &util);
+        if (control_stopped (search->control) == TRUE) {
+            break;
+        }
+        if (best > 0) {
+            int move = job->moves[best];
+            job->moves[best] = job->moves[0];
+            job->moves[0]    = move;
+        }
+    }
+
+    __atomic_fetch_add (&search->control->helper_nodes, search->nodes,
+        __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* Print XBoard's thinking output for the iteration to DEPTH, whose best line
+ * has utility UTIL: the depth, score in centipawns, time in centiseconds,
+ * nodes and principal variation, all on one line.  */
+void post_thinking (struct search *search, int depth, int util)
+{
+    char line[64 + 6 * (MAX_DEPTH + 1)];
     int i;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        /* Each legal move increases score.  */
-        if (legal_moves[i] == TRUE) {
-            score++;
-            
-            /* Each enemy piece attacked increases score.  */
-            if (board[i] * mod < chp_null) {
-                printf (":: EVAL: %c attacking piece\n", (player == WPLAYER) ?
-                    'W' : 'B');
-                score -= board[i] * mod;
+
+    int n = sprintf (line, "%d %d %ld %ld", depth, util / MATERIAL_WT,
+        (get_time_ms () - search->control->start) / 10, search->nodes);
+    for (i = 0; i < search->best_pv_length; i++) {
+        line[n++] = ' ';
+        move_string (search->best_pv[i], line + n);
+        n += strlen (line + n);
+    }
+    printf ("%s\n", line);
+}
+
+/* Return TRUE if SEARCH should stop now: its time or node budget is out, or
+ * another thread has interrupted it.  */
+int search_stopped (struct search *search)
+{
+    struct search_control *control = search->control;
+    return get_time_ms () >= control_stop_time (control)
+        || search->nodes >= control->max_nodes
+        || (control->interrupt != NULL
+            && __atomic_load_n (control->interrupt, __ATOMIC_RELAXED) != 0);
+}
+
+/* Return TRUE once the search CONTROL controls has been stopped.  */
+int control_stopped (struct search_control *control)
+{
+    return __atomic_load_n (&control->stopped, __ATOMIC_ACQUIRE);
+}
+
+/* Stop the search CONTROL controls. Its threads see it at their next
+ * check.  */
+void stop_control (struct search_control *control)
+{
+    __atomic_store_n (&control->stopped, TRUE, __ATOMIC_RELEASE);
+}
+
+/* Return the time, in milliseconds, the search CONTROL controls stops at.  */
+long control_stop_time (struct search_control *control)
+{
+    return __atomic_load_n (&control->stop_time, __ATOMIC_RELAXED);
+}
+
+/* Move the time the search CONTROL controls stops at to STOP_TIME.  */
+void set_stop_time (struct search_control *control, long stop_time)
+{
+    __atomic_store_n (&control->stop_time, stop_time, __ATOMIC_RELAXED);
+}
+
+/* Make MOVE, searched at PLY, the start of the principal variation there,
+ * followed by the line found below it.  */
+void update_pv (struct search *search, int ply, int move)
+{
+    int length = search->pv_length[ply + 1], i;
+
+    search->pv[ply][ply] = move;
+    for (i = ply + 1; i < length; i++) {
+        search->pv[ply][i] = search->pv[ply + 1][i];
+    }
+    search->pv_length[ply] = length;
+}
+
+/* Return the best move the transposition table holds for PLAYER in POSITION,
+ * or 0 if it holds none or one that isn't legal (because of a key
+ * collision).  */
+int hash_move (struct position *position, int player)
+{
+    int moves[MAX_MOVES], move = 0, i;
+    int tt_score, tt_depth, tt_bound;
+
+    if (tt_probe (position->hash_key, &move, &tt_score, &tt_depth,
+        &tt_bound) == FALSE || move == 0) {
+        return 0;
+    }
+    int count = gen_all_legal_moves (position, player, moves);
+    for (i = 0; i < count && moves[i] != move; i++) {
+    }
+    return (i < count) ? move : 0;
+}
+
+/* Return SCORE, found at PLY, as the transposition table keeps it: a mate
+ * score counts plies from the position rather than the root.  */
+int mate_to_tt (int score, int ply)
+{
+    if (score >= MATE_BOUND) {
+        return score + ply;
+    }
+    if (score <= -MATE_BOUND) {
+        return score - ply;
+    }
+    return score;
+}
+
+/* The inverse of mate_to_tt, for a SCORE read from the table at PLY.  */
+int mate_from_tt (int score, int ply)
+{
+    if (score >= MATE_BOUND) {
+        return score - ply;
+    }
+    if (score <= -MATE_BOUND) {
+        return score + ply;
+    }
+    return score;
+}
+
+/* Search PLAYER's COUNT root moves in LEGAL_MOVES to DEPTH, within a window
+ * around SCORE, the last iteration's, once DEPTH reaches ASPIRATION_DEPTH.
+ * The window is widened and the moves searched again until the score falls
+ * inside it. The best move is swapped to the front of LEGAL_MOVES, its line
+ * copied to SEARCH->BEST_PV and 0 returned, with its score in *UTIL. If the
+ * search is stopped before any move could be trusted, -1 is returned.  */
+int aspiration_search (struct search *search, int player, int *legal_moves,
+    int count, int depth, int score, int *util)
+{
+    int alpha = NEG_INF, beta = POS_INF, delta = ASPIRATION_WINDOW;
+    int found = -1;
+
+    if (depth >= ASPIRATION_DEPTH) {
+        alpha = (score - delta > NEG_INF) ? score - delta : NEG_INF;
+        beta  = (score + delta < POS_INF) ? score + delta : POS_INF;
+    }
+
+    while (TRUE) {
+        int window_util;
+        int best = search_root (search, player, legal_moves, count, depth,
+            alpha, beta, &window_util);
+        int fail_low = (window_util <= alpha && alpha > NEG_INF);
+
+        /* When every move fails low their scores are only upper bounds, so
+         * none of them can be trusted as the best. An unfinished search's
+         * best move is only trusted if it beat the previous best, which is
+         * always searched first.  */
+        if (best >= 0 && fail_low == FALSE) {
+            int move = legal_moves[best];
+            legal_moves[best] = legal_moves[0];
+            legal_moves[0]    = move;
+            memcpy (search->best_pv, search->pv[0],
+                search->pv_length[0] * sizeof (int));
+            search->best_pv_length = search->pv_length[0];
+            *util = window_util;
+            found = 0;
+        }
+        if (control_stopped (search->control) == TRUE) {
+            break;
+        }
+
+        delta *= 2;
+        if (fail_low == TRUE) {
+            alpha = (alpha - delta > NEG_INF) ? alpha - delta : NEG_INF;
+        } else if (window_util >= beta && beta < POS_INF) {
+            beta = (beta + delta < POS_INF) ? beta + delta : POS_INF;
+        } else {
+            break;
+        }
+    }
+    return found;
+}
+
+/* Search each of PLAYER's COUNT root moves in LEGAL_MOVES to DEPTH within the
+ * window ALPHA to BETA and return the index of the best one, storing its
+ * score in *UTIL. A score at or below ALPHA is only an upper bound on the
+ * true one, and one at or above BETA a lower bound, found without searching
+ * the moves after it. If the search is stopped, return the best of the moves
+ * searched so far, or -1 if the first move wasn't finished.  */
+int search_root (struct search *search, int player, int *legal_moves,
+    int count, int depth, int alpha, int beta, int *util)
+{
+    struct position *position = search->position;
+    int curr_util = NEG_INF, best = -1, i;
+
+    for (i = 0; i < count; i++) {
+        move_piece (position, legal_moves[i]);
+        search->pv_length[1] = 1;
+
+        /* If the move wins the game, automatically make it.  */
+        if (game_over (position) == TRUE) {
+            unmove_piece (position, legal_moves[i]);
+            update_pv (search, 0, legal_moves[i]);
+            *util = POS_INF;
+            return i;
+        }
+
+        /* The first move gets the full window. The rest only need to be
+         * shown no better than the best so far, which a null window does
+         * more cheaply, and are searched again in full if they are.  */
+        int window = (curr_util > alpha) ? curr_util : alpha;
+        int move_util, opponent = opponent_player (player);
+        search->follow_pv = (search->best_pv_length > 0
+            && legal_moves[i] == search->best_pv[0]);
+        if (best < 0) {
+            move_util = -1 * search_node (search, opponent, depth - 1, 1,
+                -1 * beta, -1 * window);
+        } else {
+            move_util = -1 * search_node (search, opponent, depth - 1, 1,
+                -1 * window - 1, -1 * window);
+            if (move_util > window && move_util < beta) {
+                move_util = -1 * search_node (search, opponent, depth - 1, 1,
+                    -1 * beta, -1 * window);
+            }
+        }
+        unmove_piece (position, legal_moves[i]);
+
+        if (control_stopped (search->control) == TRUE) {
+            break;
+        }
+
+        /* If move is best yet, save it.  */
+        if (best < 0 || move_util > curr_util) {
+            curr_util = move_util;
+            best      = i;
+            update_pv (search, 0, legal_moves[i]);
+        }
+        if (curr_util >= beta) {
+            break;
+        }
+    }
+
+    if (control_stopped (search->control) == FALSE && best >= 0) {
+        int bound = TT_EXACT;
+        if (curr_util <= alpha) {
+            bound = TT_UPPER;
+        } else if (curr_util >= beta) {
+            bound = TT_LOWER;
+        }
+        tt_store (position->hash_key, legal_moves[best], curr_util, depth,
+            bound);
+    }
+    *util = curr_util;
+    return best;
+}
+
+/* Return the utility for PLAYER, to move, of searching DEPTH plies on from
+ * PLY, or once DEPTH reaches 0 of settling the captures left on the
+ * board.  */
+int search_node (struct search *search, int player, int depth, int ply,
+    int alpha, int beta)
+{
+    if (depth <= 0) {
+        return quiesce (search, player, ply, alpha, beta);
+    }
+    return abp_search (search, player, depth, ply, alpha, beta);
+}
+
+/* Alpha-beta pruning search. Returns the utility of the position for PLAYER,
+ * who is to move. PLY is the distance from the root.  */
+int abp_search (struct search *search, int player, int depth, int ply,
+    int alpha, int beta)
+{
+    struct position *position = search->position;
+    int legal_moves[MAX_MOVES], scores[MAX_MOVES];
+    int curr_util = NEG_INF, best = 0, i;
+    int orig_alpha = alpha, opponent = opponent_player (player);
+
+    search->pv_length[ply] = ply;
+
+    /* Every few thousand nodes check whether time or the node budget is out,
+     * or the search was interrupted, and give up if so. Callers discard the
+     * result of a stopped search.  */
+    if ((++search->nodes & (CHECK_NODES - 1)) == 0
+        && search_stopped (search) == TRUE) {
+        stop_control (search->control);
+    }
+    if (control_stopped (search->control) == TRUE) {
+        return 0;
+    }
+
+    /* While still on the best line found so far, its move here goes
+     * first.  */
+    int pv_move = 0;
+    if (search->follow_pv == TRUE && ply < search->best_pv_length) {
+        pv_move = search->best_pv[ply];
+    }
+    search->follow_pv = FALSE;
+
+    /* Endgames of three pieces or fewer are looked up rather than searched.  */
+    int bitbase_score;
+    if (bitbase_probe (position, player, ply, &bitbase_score) == TRUE) {
+        return bitbase_score;
+    }
+
+    /* A position already searched at least this deep may not need searching
+     * again, if its stored bound is outside the window. Only null window
+     * searches take the shortcut, so principal variations aren't cut
+     * short.  */
+    int tt_move = 0, tt_score, tt_depth, tt_bound;
+    int found = tt_probe (position->hash_key, &tt_move, &tt_score, &tt_depth,
+        &tt_bound);
+    search->tt_probes++;
+    search->tt_hits += found;
+    tt_score = mate_from_tt (tt_score, ply);
+    if (found == TRUE && tt_depth >= depth && beta - alpha == 1) {
+        if (tt_bound == TT_EXACT
+            || (tt_bound == TT_LOWER && tt_score >= beta)
+            || (tt_bound == TT_UPPER && tt_score <= alpha)) {
+            return tt_score;
+        }
+    }
+
+    /* Null move pruning: if PLAYER could pass and a shallower search still
+     * fails high, a real move almost certainly would too. Passing proves
+     * nothing when in check, or with only pawns left, where having to move
+     * can be what loses (zugzwang). Only null window searches are pruned, and
+     * never straight after a pass, as two in a row only hand the move back.  */
+    int in_check = player_in_check (position, player);
+    uint64_t pieces = position->side_bb[player]
+        & ~position->piece_bb[player][chp_wpawn]
+        & ~position->piece_bb[player][chp_wking];
+    int after_null = position->undo_count > 0
+        && position->undo_stack[position->undo_count - 1].null_move == TRUE;
+    if (beta - alpha == 1 && depth >= search_params.null_move_depth
+        && in_check == FALSE && pieces != 0 && after_null == FALSE) {
+        move_null (position);
+        search->follow_pv = FALSE;
+        int null_util = -1 * search_node (search, opponent,
+            depth - 1 - search_params.null_move_r, ply + 1, -1 * beta,
+            -1 * beta + 1);
+        unmove_null (position);
+
+        if (control_stopped (search->control) == TRUE) {
+            return 0;
+        }
+        if (null_util >= beta) {
+            return beta;
+        }
+    }
+
+    /* Generate moves for each of PLAYER's pieces and evaluate their utility,
+     * most promising first. Track the move with the greatest utility.  */
+    int count = gen_all_plegal_moves (position, player, legal_moves);
+    score_moves (search, player, legal_moves, scores, count,
+        (pv_move != 0) ? pv_move : tt_move, ply);
+
+    for (i = 0; i < count; i++) {
+        pick_move (legal_moves, scores, count, i);
+
+        /* Taking the king wins the game, scored by how near the root it's
+         * taken (see MATE_BOUND) rather than by evaluating a board without
+         * it. Captures are ordered by victim, so this is tried first.  */
+        if (PIECE_TYPE (MOVE_CAPTURED (legal_moves[i])) == chp_wking) {
+            return POS_INF - ply;
+        }
+        move_piece (position, legal_moves[i]);
+        int move_util = 0;
+
+        /* Late move reductions: quiet moves ordered this late rarely turn
+         * out best, so are searched less deeply, unless PLAYER is escaping
+         * check or the move gives check.  */
+        int reduction = 0;
+        if (i >= search_params.lmr_moves && depth >= search_params.lmr_depth
+            && in_check == FALSE
+            && MOVE_CAPTURED (legal_moves[i]) == chp_null
+            && MOVE_PROMOTION (legal_moves[i]) == 0
+            && player_in_check (position, opponent) == FALSE) {
+            reduction = search_params.lmr_reduction;
+        }
+
+        /* Principal variation search: the first move is searched with the
+         * full window and the rest, expected to be worse, with a null window
+         * at alpha. Only a move proving better is searched again, at full
+         * depth and then in full. The opponent's utility is the negation of
+         * ours.  */
+        search->pv_length[ply + 1] = ply + 1;
+        search->follow_pv = (legal_moves[i] == pv_move);
+        if (i == 0) {
+            move_util = -1 * search_node (search, opponent, depth - 1,
+                ply + 1, -1 * beta, -1 * alpha);
+        } else {
+            move_util = -1 * search_node (search, opponent,
+                depth - 1 - reduction, ply + 1, -1 * alpha - 1, -1 * alpha);
+            if (reduction > 0 && move_util > alpha) {
+                move_util = -1 * search_node (search, opponent, depth - 1,
+                    ply + 1, -1 * alpha - 1, -1 * alpha);
+            }
+            if (move_util > alpha && move_util < beta) {
+                move_util = -1 * search_node (search, opponent, depth - 1,
+                    ply + 1, -1 * beta, -1 * alpha);
             }
         }
+        unmove_piece (position, legal_moves[i]);
+
+        if (control_stopped (search->control) == TRUE) {
+            return 0;
+        }
+        
+        /* If this move's utility is a new maximum, save it. Alter alpha value
+         * and check against beta to potentially short circuit the search.  */
+        if (move_util > curr_util) {
+            curr_util = move_util;
+            best      = legal_moves[i];
+        }
+        if (curr_util > alpha) {
+            alpha = curr_util;
+            update_pv (search, ply, best);
+        }
+        if (alpha >= beta) {
+            search->beta_cutoffs++;
+            if (i == 0) {
+                search->first_move_cutoffs++;
+            }
+            if (MOVE_CAPTURED (legal_moves[i]) == chp_null
+                && MOVE_PROMOTION (legal_moves[i]) == 0) {
+                update_ordering (search, player, legal_moves[i], depth, ply);
+            }
+            break;
+        }
+    }
+
+    /* Remember the result. Scores outside the original window are only
+     * bounds on the true utility.  */
+    int bound = TT_EXACT;
+    if (curr_util <= orig_alpha) {
+        bound = TT_UPPER;
+    } else if (curr_util >= beta) {
+        bound = TT_LOWER;
+    }
+    tt_store (position->hash_key, best, mate_to_tt (curr_util, ply), depth,
+        bound);
+
+    return curr_util;
+}
+
+/* Quiescence search. Returns the utility for PLAYER, who is to move, once no
+ * captures are left to change it. PLAYER may stand pat on the board's current
+ * utility instead of capturing, so only captures are searched.  */
+int quiesce (struct search *search, int player, int ply, int alpha,
+    int beta)
+{
+    struct position *position = search->position;
+    int legal_moves[MAX_MOVES], scores[MAX_MOVES], i;
+
+    if ((++search->nodes & (CHECK_NODES - 1)) == 0
+        && search_stopped (search) == TRUE) {
+        stop_control (search->control);
+    }
+    if (control_stopped (search->control) == TRUE) {
+        return 0;
+    }
+
+    /* A capture into a known endgame needs no standing pat.  */
+    int bitbase_score;
+    if (bitbase_probe (position, player, ply, &bitbase_score) == TRUE) {
+        return bitbase_score;
+    }
+
+    /* BOARD_UTILITY favours black, so negate it for white.  */
+    search->evals++;
+    int stand_pat = board_utility (position);
+    if (player == WPLAYER) {
+        stand_pat = -1 * stand_pat;
+    }
+    if (stand_pat >= beta) {
+        return stand_pat;
+    }
+    if (stand_pat > alpha) {
+        alpha = stand_pat;
+    }
+
+    int count = gen_all_plegal_captures (position, player, legal_moves);
+    score_moves (search, player, legal_moves, scores, count, 0, ply);
+
+    for (i = 0; i < count; i++) {
+        pick_move (legal_moves, scores, count, i);
+        int move = legal_moves[i];
+
+        /* Taking the king scores as it does in abp_search.  */
+        if (PIECE_TYPE (MOVE_CAPTURED (move)) == chp_wking) {
+            return POS_INF - ply;
+        }
+
+        /* Delta pruning: skip captures that can't win enough material to
+         * matter.  */
+        int gain = piece_values[PIECE_TYPE (MOVE_CAPTURED (move))];
+        if (MOVE_PROMOTION (move) != 0) {
+            gain += piece_values[MOVE_PROMOTION (move)] - PAWN_VAL;
+        }
+        if (stand_pat + MATERIAL_WT * gain + DELTA_MARGIN <= alpha) {
+            continue;
+        }
+
+        move_piece (position, move);
+        int move_util = -1 * quiesce (search, opponent_player (player), ply + 1,
+            -1 * beta, -1 * alpha);
+        unmove_piece (position, move);
+
+        if (control_stopped (search->control) == TRUE) {
+            return 0;
+        }
+        if (move_util > alpha) {
+            alpha = move_util;
+        }
+        if (alpha >= beta) {
+            break;
+        }
+    }
+
+    return alpha;
+}
+
+/* Give each of the COUNT moves in MOVES an ordering score in SCORES. TT_MOVE,
+ * the transposition table's best move, goes first. Captures and promotions
+ * follow, most valuable victim (plus promoted piece) first and then least
+ * valuable attacker, then PLY's killer moves, then the rest by history.  */
+void score_moves (struct search *search, int player, int *moves, int *scores,
+    int count, int tt_move, int ply)
+{
+    struct position *position = search->position;
+    int i;
+    for (i = 0; i < count; i++) {
+        int move     = moves[i];
+        int captured = MOVE_CAPTURED (move);
+
+        if (move == tt_move) {
+            scores[i] = ORDER_TT;
+        } else if (captured != chp_null || MOVE_PROMOTION (move) != 0) {
+            scores[i] = ORDER_CAPTURE
+                + 8 * (PIECE_TYPE (captured) + MOVE_PROMOTION (move))
+                - PIECE_TYPE (position->board[MOVE_START (move)]);
+        } else if (move == search->killers[ply][0]) {
+            scores[i] = ORDER_KILLER_1;
+        } else if (move == search->killers[ply][1]) {
+            scores[i] = ORDER_KILLER_2;
+        } else {
+            scores[i] = search->history[player][SQ64 (MOVE_START (move))]
+                [SQ64 (MOVE_END (move))];
+        }
+    }
+}
+
+/* Swap the best scored of the moves from index FIRST on into FIRST. Moves are
+ * picked one at a time since a cutoff often makes sorting the rest
+ * pointless.  */
+void pick_move (int *moves, int *scores, int count, int first)
+{
+    int best = first, i;
+    for (i = first + 1; i < count; i++) {
+        if (scores[i] > scores[best]) {
+            best = i;
+        }
+    }
+
+    int move = moves[first], score = scores[first];
+    moves[first]  = moves[best];
+    scores[first] = scores[best];
+    moves[best]   = move;
+    scores[best]  = score;
+}
+
+/* Record that quiet MOVE by PLAYER caused a beta cutoff at DEPTH, PLY.  */
+void update_ordering (struct search *search, int player, int move,
+    int depth, int ply)
+{
+    if (search->killers[ply][0] != move) {
+        search->killers[ply][1] = search->killers[ply][0];
+        search->killers[ply][0] = move;
+    }
+
+    int *entry = &search->history[player][SQ64 (MOVE_START (move))]
+        [SQ64 (MOVE_END (move))];
+    *entry += depth * depth;
+    if (*entry > HISTORY_MAX) {
+        age_history (search);
+    }
+}
+
+/* Halve every history score, so old searches count for less and scores stay
+ * below the killer moves.  */
+void age_history (struct search *search)
+{
+    int *entry = &search->history[0][0][0];
+    int i;
+    for (i = 0; i < 2 * 64 * 64; i++) {
+        entry[i] /= 2;
+    }
+}
+
+/* Return utility of BOARD as function of material and positional scores.  */
+int board_utility (struct position *position)
+{
+    return (MATERIAL_WT * material_score (position))
+        + (POSITION_WT * positional_score (position));
+}
+
+/* Return the material (piece) score of BOARD, black's minus white's.  */
+int material_score (struct position *position)
+{
+    return position->material_total;
+}
+
+/* Return the positional utility of BOARD: the piece-square total plus the
+ * mobility of each player's knights, bishops and pawns.  */
+int positional_score (struct position *position)
+{
+    int score[2] = { 0, 0 }, player;
+    for (player = WPLAYER; player <= BPLAYER; player++) {
+        uint64_t minors = position->piece_bb[player][chp_wknight]
+            | position->piece_bb[player][chp_wbishop];
+        uint64_t pieces = minors | position->piece_bb[player][chp_wpawn];
+        while (pieces) {
+            int sq = pop_lsb (&pieces);
+            int wt = (minors & SQ_BIT (sq)) ? 2 : 1;
+            score[player] += wt * knight_pos_score (position, player,
+                SQ88 (sq));
+        }
+    }
+
+    return position->pst_total + score[BPLAYER] - score[WPLAYER];
+}
+
+/* Return position score for knight, bishop or pawn at START_POS owned by
+ * PLAYER: one point per move it has plus the value of each piece it attacks.
+ * Moves aren't checked for leaving the king in check.  */
+int knight_pos_score (struct position *position, int player, int start_pos)
+{
+    int sq = SQ64 (start_pos), opponent = opponent_player (player);
+    uint64_t occupied = position->side_bb[WPLAYER] | position->side_bb[BPLAYER];
+    uint64_t targets  = 0;
+
+    switch (PIECE_TYPE (position->board[start_pos])) {
+        case chp_wpawn:
+            targets = pawn_attacks[player][sq] & position->side_bb[opponent];
+            if (player == WPLAYER) {
+                uint64_t one = (SQ_BIT (sq) << 8) & ~occupied;
+                targets |= one | (((one & RANK_3_BB) << 8) & ~occupied);
+            } else {
+                uint64_t one = (SQ_BIT (sq) >> 8) & ~occupied;
+                targets |= one | (((one & RANK_6_BB) >> 8) & ~occupied);
+            }
+            break;
+
+        case chp_wknight:
+            targets = knight_attacks[sq] & ~position->side_bb[player];
+            break;
+
+        case chp_wbishop:
+            targets = bishop_attacks (sq, occupied)
+                & ~position->side_bb[player];
+            break;
+    }
+
+    /* Each move increases score, and each enemy piece attacked increases
+     * score by its value.  */
+    int score = bit_count (targets);
+    uint64_t attacked = targets & position->side_bb[opponent];
+    while (attacked) {
+        int target = pop_lsb (&attacked);
+        TRACE (TRACE_EVAL, "%c attacking piece", (player == WPLAYER) ?
+            'W' : 'B');
+        score += PIECE_TYPE (position->board[SQ88 (target)]);
     }
 
     return score;
@@ -13,16 +13,180 @@
 #define NEG_INF     -30000
 #define POS_INF     30000
 
-#define SEARCH_DEP  2
+/* Taking a king scores POS_INF less the ply it's taken at, counted from the
+ * root, so nearer wins score higher. Scores beyond MATE_BOUND either way are
+ * such wins or losses, and are kept in the transposition table counted from
+ * the position stored instead.  */
+#define MATE_BOUND  (POS_INF - 1000)
 
+/* A capture is skipped in quiescence search if even winning the captured
+ * piece plus this much can't raise the score to alpha.  */
+#define DELTA_MARGIN    (2 * PAWN_VAL * MATERIAL_WT)
+
+#define MAX_DEPTH   64
+#define MAX_THREADS 64
+#define CHECK_NODES 2048    /* Must be a power of two.  */
+
+/* Iterations from ASPIRATION_DEPTH on search the root within
+ * ASPIRATION_WINDOW of the last iteration's score, widening the window
+ * each time the score falls outside it.  */
+#define ASPIRATION_DEPTH    5
+#define ASPIRATION_WINDOW   (PAWN_VAL * MATERIAL_WT)
+
+/* Defaults for struct search_params.  */
+#define NULL_MOVE_R         2
+#define NULL_MOVE_DEPTH     3
+#define LMR_DEPTH           3
+#define LMR_MOVES           4
+#define LMR_REDUCTION       1
+
+/* Move ordering scores, highest searched first. History scores are kept
+ * below HISTORY_MAX.  */
+#define ORDER_TT        1000000
+#define ORDER_CAPTURE   900000
+#define ORDER_KILLER_1  800000
+#define ORDER_KILLER_2  700000
+#define HISTORY_MAX     600000
+
+/* A move as the user interface sees it. PROMOTION is the type of piece a pawn
+ * promotes to, or 0.  */
 struct move {
     int start_pos;
     int end_pos;
+    int promotion;
+};
+
+/* Limits on a search. Zero means no limit. THREADS is the number of threads
+ * to search with, 0 or 1 for just the calling thread. NODES limits the nodes
+ * searched by the calling thread, give or take CHECK_NODES. If INTERRUPT
+ * isn't NULL the search stops once another thread makes it non-zero.  */
+struct search_limits {
+    int  depth;
+    int  time_ms;
+    int  threads;
+    long nodes;
+    int *interrupt;
+};
+
+/* Parameters of the search's forward pruning, set with set_search_param.
+ *
+ * A null move search (PLAYER passes, and the opponent searches) is done at
+ * depths of NULL_MOVE_DEPTH and more, NULL_MOVE_R plies shallower than the
+ * moves would be. Late move reductions search quiet moves, from the
+ * LMR_MOVES'th on at depths of LMR_DEPTH and more, LMR_REDUCTION plies
+ * shallower, searching again at full depth if one beats alpha.  */
+struct search_params {
+    int null_move_r;
+    int null_move_depth;
+    int lmr_depth;
+    int lmr_moves;
+    int lmr_reduction;
+};
+
+/* Control of one search, shared by all its threads. Nodes are counted so the
+ * clock is only read every CHECK_NODES nodes, and once STOP_TIME passes or a
+ * thread has searched MAX_NODES STOPPED is set and every search function
+ * returns immediately. Another thread may set STOPPED, or move STOP_TIME, to
+ * end a search early or late, and INTERRUPT is checked along with the clock.
+ * Both are only accessed through control_stopped, stop_control,
+ * control_stop_time and set_stop_time, since the search's threads read them
+ * while others write. Helpers add their node counts to HELPER_NODES when
+ * they finish.  */
+struct search_control {
+    long  start;
+    long  stop_time;
+    long  max_nodes;
+    int  *interrupt;
+    int   stopped;
+    long  helper_nodes;
+};
+
+/* The state one thread searches POSITION with. CONTROL points at OWN_CONTROL
+ * for the search started by best_move, and at that search's control for its
+ * helpers. POST is TRUE to print a thinking line after each iteration, as
+ * XBoard's post command asks.
+ *
+ * KILLERS holds two quiet moves per ply that recently caused a beta cutoff
+ * there, HISTORY how often each quiet move (by player, start and end square)
+ * has caused one, weighted by depth.
+ *
+ * PV is a triangular table of principal variations: row PLY holds the best
+ * line found from that ply on, in its entries PLY to PV_LENGTH[PLY] - 1,
+ * and row 0 the line from the root. BEST_PV holds the line of the best root
+ * move found so far, whose moves are searched first while FOLLOW_PV is
+ * TRUE, that is while the search is still on that line.
+ *
+ * The rest are statistics of the last search. BETA_CUTOFFS and
+ * FIRST_MOVE_CUTOFFS measure how well ordering works: ideally almost every
+ * cutoff comes from the first move tried. EVALS counts positions evaluated,
+ * and TT_HITS how many of the TT_PROBES found their position in the
+ * transposition table. DEPTH is the deepest iteration finished and BRANCHING
+ * the ratio of its nodes to the previous iteration's.  */
+struct search {
+    struct position       *position;
+    struct search_control *control;
+    struct search_control  own_control;
+    int    post;
+    int    killers[MAX_DEPTH + 1][2];
+    int    history[2][64][64];
+    int    pv[MAX_DEPTH + 1][MAX_DEPTH + 1];
+    int    pv_length[MAX_DEPTH + 1];
+    int    best_pv[MAX_DEPTH + 1];
+    int    best_pv_length;
+    int    follow_pv;
+    long   nodes;
+    long   evals;
+    long   beta_cutoffs;
+    long   first_move_cutoffs;
+    long   tt_probes;
+    long   tt_hits;
+    int    depth;
+    double branching;
+};
+
+/* A Lazy SMP helper thread's share of a search: its own copy of the root
+ * moves, which it reorders as it goes, the position to copy and search them
+ * from and the control of the search it helps.  */
+struct helper_job {
+    pthread_t              id;
+    int                    number;
+    int                    player;
+    const struct position *root;
+    struct search_control *control;
+    int                    moves[MAX_MOVES];
+    int                    count;
+    int                    max_depth;
 };
 
-void best_move (struct move *);
-int  abp_search (int, int, int, int);
-int  board_utility ();
-int  material_score ();
-int  positional_score ();
-int  knight_pos_score (int, int);
+void init_eval ();
+int  set_search_param (const char *);
+long get_time_ms ();
+void init_search (struct search *, struct search_limits *);
+void init_thread_search (struct search *);
+double cutoff_rate (struct search *);
+int  best_move (struct search *, int, struct move *, struct search_limits *);
+int  run_search (struct search *, int, struct move *, struct search_limits *);
+void *helper_search (void *);
+int  aspiration_search (struct search *, int, int *, int, int, int, int *);
+int  search_root (struct search *, int, int *, int, int, int, int, int *);
+void post_thinking (struct search *, int, int);
+void update_pv (struct search *, int, int);
+int  hash_move (struct position *, int);
+int  mate_to_tt (int, int);
+int  mate_from_tt (int, int);
+int  search_stopped (struct search *);
+int  control_stopped (struct search_control *);
+void stop_control (struct search_control *);
+long control_stop_time (struct search_control *);
+void set_stop_time (struct search_control *, long);
+int  search_node (struct search *, int, int, int, int, int);
+int  abp_search (struct search *, int, int, int, int, int);
+int  quiesce (struct search *, int, int, int, int);
+void score_moves (struct search *, int, int *, int *, int, int, int);
+void pick_move (int *, int *, int, int);
+void update_ordering (struct search *, int, int, int, int);
+void age_history (struct search *);
+int  board_utility (struct position *);
+int  material_score (struct position *);
+int  positional_score (struct position *);
+int  knight_pos_score (struct position *, int, int);
@@ -0,0 +1,190 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "board.h"
+#include "ai.h"
+#include "engine.h"
+#include "batch.h"
+
+/* Analyse each FEN line read from IN within LIMITS and write one line for it
+ * to OUT, in the order they were read: the score for the player to move, the
+ * best move, the nodes searched and the time taken. Lines are analysed by
+ * THREADS worker threads while this thread reads ahead of them and writes
+ * their results. Return the number of lines analysed, or -1 if no worker
+ * could be started.  */
+long batch_analyse (FILE *in, FILE *out, struct search_limits *limits,
+    int threads)
+{
+    static struct batch_queue queue;
+    pthread_t ids[BATCH_MAX_THREADS];
+    char line[BATCH_LINE_SIZE];
+    int i;
+
+    pthread_mutex_init (&queue.lock, NULL);
+    pthread_cond_init (&queue.changed, NULL);
+    queue.read = queue.taken = queue.written = 0;
+    queue.eof    = FALSE;
+    queue.limits = *limits;
+    queue.limits.threads = 1;
+
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > BATCH_MAX_THREADS) {
+        threads = BATCH_MAX_THREADS;
+    }
+    for (i = 0; i < threads; i++) {
+        if (pthread_create (&ids[i], NULL, batch_worker, &queue) != 0) {
+            break;
+        }
+    }
+    threads = i;
+    if (threads == 0) {
+        return -1;
+    }
+
+    /* Queue each line, waiting for the oldest to be written out when the
+     * queue is full.  */
+    while (fgets (line, sizeof (line), in) != NULL) {
+        /* The rest of a line too long for LINE is skipped, and the line
+         * reported as a single error.  */
+        int too_long = FALSE, c;
+        if (strchr (line, '\n') == NULL) {
+            while ((c = getc (in)) != EOF && c != '\n') {
+                too_long = TRUE;
+            }
+        }
+        line[strcspn (line, "\r\n")] = '\0';
+
+        pthread_mutex_lock (&queue.lock);
+        while (queue.read - queue.written == BATCH_QUEUE_SIZE) {
+            if (batch_flush (&queue, out) == 0) {
+                pthread_cond_wait (&queue.changed, &queue.lock);
+            }
+        }
+
+        struct batch_item *item = &queue.items[queue.read % BATCH_QUEUE_SIZE];
+        strcpy (item->line, line);
+        item->too_long = too_long;
+        item->state    = BATCH_QUEUED;
+        queue.read++;
+        pthread_cond_broadcast (&queue.changed);
+        batch_flush (&queue, out);
+        pthread_mutex_unlock (&queue.lock);
+    }
+
+    /* Let the workers finish once the queue is empty, and write out the
+     * rest.  */
+    pthread_mutex_lock (&queue.lock);
+    queue.eof = TRUE;
+    pthread_cond_broadcast (&queue.changed);
+    while (queue.written < queue.read) {
+        if (batch_flush (&queue, out) == 0) {
+            pthread_cond_wait (&queue.changed, &queue.lock);
+        }
+    }
+    pthread_mutex_unlock (&queue.lock);
+
+    for (i = 0; i < threads; i++) {
+        pthread_join (ids[i], NULL);
+    }
+    pthread_cond_destroy (&queue.changed);
+    pthread_mutex_destroy (&queue.lock);
+    return queue.written;
+}
+
+/* Thread body for batch_analyse: analyse queued lines until the input runs
+ * out.  */
+void *batch_worker (void *arg)
+{
+    struct batch_queue *queue = arg;
+
+    pthread_mutex_lock (&queue->lock);
+    for (;;) {
+        while (queue->taken == queue->read && queue->eof == FALSE) {
+            pthread_cond_wait (&queue->changed, &queue->lock);
+        }
+        if (queue->taken == queue->read) {
+            break;
+        }
+
+        /* The item is this thread's until it's marked done.  */
+        struct batch_item *item =
+            &queue->items[queue->taken++ % BATCH_QUEUE_SIZE];
+        pthread_mutex_unlock (&queue->lock);
+        if (item->too_long == TRUE) {
+            snprintf (item->result, BATCH_LINE_SIZE, "error line too long\n");
+        } else {
+            analyse_fen (item->line, &queue->limits, item->result);
+        }
+        pthread_mutex_lock (&queue->lock);
+
+        item->state = BATCH_DONE;
+        pthread_cond_broadcast (&queue->changed);
+    }
+    pthread_mutex_unlock (&queue->lock);
+    return NULL;
+}
+
+/* Write out the results of the oldest lines in QUEUE that have been analysed
+ * and return how many were written. Called with QUEUE->LOCK held, which is
+ * released while writing since no other thread touches a finished item.  */
+int batch_flush (struct batch_queue *queue, FILE *out)
+{
+    int count = 0;
+    while (queue->written < queue->read) {
+        struct batch_item *item =
+            &queue->items[queue->written % BATCH_QUEUE_SIZE];
+        if (item->state != BATCH_DONE) {
+            break;
+        }
+
+        pthread_mutex_unlock (&queue->lock);
+        fputs (item->result, out);
+        pthread_mutex_lock (&queue->lock);
+        item->state = BATCH_EMPTY;
+        queue->written++;
+        count++;
+    }
+
+    if (count > 0) {
+        pthread_mutex_unlock (&queue->lock);
+        fflush (out);
+        pthread_mutex_lock (&queue->lock);
+    }
+    return count;
+}
+
+/* Search the position described by FEN within LIMITS and write the line
+ * reporting it, newline included, to RESULT, which must hold BATCH_LINE_SIZE
+ * characters. The score is in centipawns, as XBoard is sent it. Every
+ * position is searched from scratch, apart from what the shared
+ * transposition table remembers.  */
+void analyse_fen (const char *fen, struct search_limits *limits, char *result)
+{
+    struct position position;
+    struct search search;
+
+    int player = set_fen (&position, fen);
+    if (player < 0) {
+        snprintf (result, BATCH_LINE_SIZE, "error bad fen\n");
+        return;
+    }
+
+    memset (&search, 0, sizeof (search));
+    search.position = &position;
+    struct move mv = { 0, 0, 0 };
+    long start = get_time_ms ();
+    int score = best_move (&search, player, &mv, limits);
+    long elapsed = get_time_ms () - start;
+
+    /* A checkmated or stalemated player has no move.  */
+    char move[6] = "none";
+    if (mv.start_pos != mv.end_pos) {
+        unparse_move (&mv, move);
+    }
+    snprintf (result, BATCH_LINE_SIZE,
+        "score %d move %s nodes %ld time %ld\n", score / MATERIAL_WT, move,
+        search.nodes, elapsed);
+}
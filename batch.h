@@ -0,0 +1,39 @@
+#define BATCH_MAX_THREADS   64
+#define BATCH_QUEUE_SIZE    256     /* Positions read ahead of the output.  */
+#define BATCH_LINE_SIZE     256
+
+/* States of a position in the batch queue.  */
+#define BATCH_EMPTY     0
+#define BATCH_QUEUED    1
+#define BATCH_DONE      2
+
+/* A FEN line read from the input and, once it's been analysed, the line to
+ * write out for it. TOO_LONG is set if the line didn't fit in LINE.  */
+struct batch_item {
+    int  state;
+    int  too_long;
+    char line[BATCH_LINE_SIZE];
+    char result[BATCH_LINE_SIZE];
+};
+
+/* Positions shared between the thread reading and writing them and the
+ * workers analysing them. ITEMS is a ring indexed by line number modulo
+ * BATCH_QUEUE_SIZE. READ lines have been read, TAKEN of them handed to a
+ * worker and WRITTEN written out, so a slot is only reused once its result
+ * has been written. LOCK guards everything but the text of an item owned by a
+ * worker, and CHANGED is signalled when a line is read or analysed.  */
+struct batch_queue {
+    pthread_mutex_t      lock;
+    pthread_cond_t       changed;
+    struct batch_item    items[BATCH_QUEUE_SIZE];
+    long                 read;
+    long                 taken;
+    long                 written;
+    int                  eof;
+    struct search_limits limits;
+};
+
+long  batch_analyse (FILE *, FILE *, struct search_limits *, int);
+void *batch_worker (void *);
+int   batch_flush (struct batch_queue *, FILE *);
+void  analyse_fen (const char *, struct search_limits *, char *);
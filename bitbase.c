@@ -0,0 +1,301 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bitboard.h"
+#include "board.h"
+#include "ai.h"
+#include "bitbase.h"
+
+/* One byte per position of each endgame, see BITBASE_ILLEGAL.  */
+uint8_t bitbase_tables[BITBASES][BITBASE_SIZE];
+
+/* The strong side's piece in each endgame.  */
+const int bitbase_pieces[BITBASES] = { chp_wpawn, chp_wrook, chp_wqueen };
+
+/* Fill the tables by retrograde analysis, or from the cache file at PATH if
+ * it holds them, saving them there for next time. PATH may be NULL for no
+ * cache. The pawn endgame needs the others, for its promotions. Searches
+ * probe the tables without locking, so this must run before any starts.  */
+void bitbase_init (const char *path)
+{
+    if (path != NULL && bitbase_load (path) == TRUE) {
+        return;
+    }
+    bitbase_generate (BITBASE_KQK);
+    bitbase_generate (BITBASE_KRK);
+    bitbase_generate (BITBASE_KPK);
+    if (path != NULL) {
+        bitbase_save (path);
+    }
+}
+
+/* Read the tables from the file at PATH. Returns FALSE if it doesn't hold
+ * them.  */
+int bitbase_load (const char *path)
+{
+    FILE *in = fopen (path, "rb");
+    uint32_t magic = 0;
+
+    if (in == NULL) {
+        return FALSE;
+    }
+    int ok = fread (&magic, sizeof (magic), 1, in) == 1
+        && magic == BITBASE_MAGIC
+        && fread (bitbase_tables, sizeof (bitbase_tables), 1, in) == 1;
+    fclose (in);
+    return ok;
+}
+
+/* Write the tables to the file at PATH. They're only a cache, so nothing is
+ * lost if it can't be written.  */
+void bitbase_save (const char *path)
+{
+    FILE *out = fopen (path, "wb");
+    uint32_t magic = BITBASE_MAGIC;
+
+    if (out == NULL) {
+        return;
+    }
+    if (fwrite (&magic, sizeof (magic), 1, out) != 1
+        || fwrite (bitbase_tables, sizeof (bitbase_tables), 1, out) != 1) {
+        fclose (out);
+        remove (path);
+        return;
+    }
+    fclose (out);
+}
+
+/* Work out every position of TABLE. Positions where the bare king is mated
+ * are found first, then those won a ply later, those lost a ply after that
+ * and so on until no more turn up. Whatever is left is drawn.  */
+void bitbase_generate (int table)
+{
+    uint8_t *values = bitbase_tables[table];
+    int index, plies, empty = 0;
+
+    for (index = 0; index < BITBASE_SIZE; index++) {
+        int stm = index >> 18, wk = (index >> 12) & 63;
+        int bk = (index >> 6) & 63, x = index & 63;
+        values[index] = 0;
+        if (bitbase_legal (table, stm, wk, bk, x) == FALSE) {
+            values[index] = BITBASE_ILLEGAL;
+        } else if (stm == BPLAYER
+            && (bitbase_attacks (table, x, SQ_BIT (wk) | SQ_BIT (bk))
+                & SQ_BIT (bk))
+            && bitbase_black_loses (table, wk, bk, x, 0) == TRUE) {
+            values[index] = 1;
+        }
+    }
+
+    /* Promotions lead into other tables, so quiet layers don't mean the
+     * pawn endgame is done until they're past the longest mate there.  */
+    int longest = 0;
+    if (table == BITBASE_KPK) {
+        for (index = 0; index < BITBASE_SIZE; index++) {
+            int queen = bitbase_tables[BITBASE_KQK][index];
+            int rook  = bitbase_tables[BITBASE_KRK][index];
+            if (queen != BITBASE_ILLEGAL && queen > longest) {
+                longest = queen;
+            }
+            if (rook != BITBASE_ILLEGAL && rook > longest) {
+                longest = rook;
+            }
+        }
+    }
+
+    for (plies = 1; plies < BITBASE_ILLEGAL - 1; plies++) {
+        int stm = (plies & 1) ? WPLAYER : BPLAYER, changed = FALSE;
+        for (index = stm << 18; index < (stm + 1) << 18; index++) {
+            if (values[index] != 0) {
+                continue;
+            }
+            int wk = (index >> 12) & 63, bk = (index >> 6) & 63;
+            int x = index & 63;
+            if ((stm == WPLAYER)
+                ? bitbase_white_wins (table, wk, bk, x, plies)
+                : bitbase_black_loses (table, wk, bk, x, plies)) {
+                values[index] = plies + 1;
+                changed = TRUE;
+            }
+        }
+
+        empty = (changed == TRUE) ? 0 : empty + 1;
+        if (empty >= 2 && plies > longest) {
+            break;
+        }
+    }
+}
+
+/* Return TRUE if the position of TABLE with STM to move, the kings on WK and
+ * BK and white's piece on X, could arise in a game.  */
+int bitbase_legal (int table, int stm, int wk, int bk, int x)
+{
+    if (wk == bk || x == wk || x == bk || (king_attacks[wk] & SQ_BIT (bk))) {
+        return FALSE;
+    }
+    if (table == BITBASE_KPK && (x < 8 || x >= 56)) {
+        return FALSE;
+    }
+
+    /* Black can't have been left in check.  */
+    return stm == BPLAYER
+        || (bitbase_attacks (table, x, SQ_BIT (wk) | SQ_BIT (bk))
+            & SQ_BIT (bk)) == 0;
+}
+
+/* Return the squares attacked by white's piece of TABLE on X, with the
+ * squares in OCCUPIED blocking it.  */
+uint64_t bitbase_attacks (int table, int x, uint64_t occupied)
+{
+    switch (table) {
+        case BITBASE_KPK: return pawn_attacks[WPLAYER][x];
+        case BITBASE_KRK: return rook_attacks (x, occupied);
+        default:          return queen_attacks (x, occupied);
+    }
+}
+
+/* Return TRUE if white, to move in the position of TABLE given by WK, BK and
+ * X, has a move to a position where black is mated in PLIES - 1 plies.  */
+int bitbase_white_wins (int table, int wk, int bk, int x, int plies)
+{
+    uint8_t *values = bitbase_tables[table];
+    uint64_t occupied = SQ_BIT (wk) | SQ_BIT (bk) | SQ_BIT (x);
+
+    uint64_t targets = king_attacks[wk] & ~king_attacks[bk] & ~occupied;
+    while (targets) {
+        int to = pop_lsb (&targets);
+        if (values[BITBASE_INDEX (BPLAYER, to, bk, x)] == plies) {
+            return TRUE;
+        }
+    }
+
+    if (table != BITBASE_KPK) {
+        targets = bitbase_attacks (table, x, occupied) & ~occupied;
+        while (targets) {
+            int to = pop_lsb (&targets);
+            if (values[BITBASE_INDEX (BPLAYER, wk, bk, to)] == plies) {
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    /* A pawn pushes one square, or two from its first, and on the last row
+     * becomes a queen or, to dodge stalemate, a rook.  */
+    int to = x + 8;
+    if (occupied & SQ_BIT (to)) {
+        return FALSE;
+    }
+    if (to >= 56) {
+        return bitbase_tables[BITBASE_KQK][BITBASE_INDEX (BPLAYER, wk, bk, to)]
+            == plies
+            || bitbase_tables[BITBASE_KRK][BITBASE_INDEX (BPLAYER, wk, bk, to)]
+            == plies;
+    }
+    if (values[BITBASE_INDEX (BPLAYER, wk, bk, to)] == plies) {
+        return TRUE;
+    }
+    return x < 16 && (occupied & SQ_BIT (to + 8)) == 0
+        && values[BITBASE_INDEX (BPLAYER, wk, bk, to + 8)] == plies;
+}
+
+/* Return TRUE if black, to move in the position of TABLE given by WK, BK and
+ * X, has moves and they all lead to positions white wins within PLIES - 1
+ * plies. Black taking white's piece is a draw.  */
+int bitbase_black_loses (int table, int wk, int bk, int x, int plies)
+{
+    uint8_t *values = bitbase_tables[table];
+
+    /* The black king can't step along a line it's being checked on, so it
+     * doesn't block the attacks.  */
+    uint64_t attacked = king_attacks[wk]
+        | bitbase_attacks (table, x, SQ_BIT (wk) | SQ_BIT (x));
+    uint64_t targets = king_attacks[bk] & ~attacked;
+    if (targets == 0) {
+        return plies == 0;
+    }
+
+    while (targets) {
+        int to = pop_lsb (&targets);
+        int value = values[BITBASE_INDEX (WPLAYER, wk, to, x)];
+        if (to == x || value == 0 || value == BITBASE_ILLEGAL
+            || value > plies) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* If POSITION, PLY plies from the search's root, is one of the endgames
+ * known, or has bare kings, set *SCORE to its exact utility for PLAYER, to
+ * move, and return TRUE. Won and lost positions score as the search scores
+ * the king capture that follows mate, see MATE_BOUND. bitbase_init must
+ * have built the tables.  */
+int bitbase_probe (struct position *position, int player, int ply,
+    int *score)
+{
+    /* The search takes kings, and a position missing one is left to it.  */
+    if (position->piece_bb[WPLAYER][chp_wking] == 0
+        || position->piece_bb[BPLAYER][chp_wking] == 0) {
+        return FALSE;
+    }
+
+    int count = position->piece_count[WPLAYER]
+        + position->piece_count[BPLAYER];
+    if (count == 2) {
+        *score = 0;
+        return TRUE;
+    }
+    if (count != 3) {
+        return FALSE;
+    }
+
+    /* Find the side with a piece besides its king.  */
+    int strong = (position->piece_count[WPLAYER] == 2) ? WPLAYER : BPLAYER;
+    int i, pos = NO_SQUARE;
+    for (i = 0; i < 2; i++) {
+        pos = position->piece_list[strong][i];
+        if (PIECE_TYPE (position->board[pos]) != chp_wking) {
+            break;
+        }
+    }
+
+    int table;
+    switch (PIECE_TYPE (position->board[pos])) {
+        case chp_wpawn:  table = BITBASE_KPK; break;
+        case chp_wrook:  table = BITBASE_KRK; break;
+        case chp_wqueen: table = BITBASE_KQK; break;
+        default:
+            /* A lone minor piece can't mate.  */
+            *score = 0;
+            return TRUE;
+    }
+
+    int wk = (strong == WPLAYER) ? position->wking_pos : position->bking_pos;
+    int bk = (strong == WPLAYER) ? position->bking_pos : position->wking_pos;
+    wk = SQ64 (wk);
+    bk = SQ64 (bk);
+    int x = SQ64 (pos);
+    if (strong == BPLAYER) {
+        wk ^= 56;
+        bk ^= 56;
+        x  ^= 56;
+    }
+
+    int stm = (player == strong) ? WPLAYER : BPLAYER;
+    int value = bitbase_tables[table][BITBASE_INDEX (stm, wk, bk, x)];
+    if (value == BITBASE_ILLEGAL) {
+        return FALSE;
+    }
+    if (value == 0) {
+        *score = 0;
+    } else {
+        /* Mate comes VALUE - 1 plies on, and the king is taken a ply
+         * later.  */
+        *score = (stm == WPLAYER) ? POS_INF - (ply + value)
+            : -(POS_INF - (ply + value));
+    }
+    return TRUE;
+}
@@ -0,0 +1,30 @@
+#define BITBASE_MAGIC   0x42424b52  /* "RKBB" at the start of a cache.  */
+#define BITBASE_SIZE    (2 * 64 * 64 * 64)
+
+/* The endgames known, each a king and one other piece against a bare
+ * king.  */
+#define BITBASE_KPK     0
+#define BITBASE_KRK     1
+#define BITBASE_KQK     2
+#define BITBASES        3
+
+/* Values stored for a position: 0 when it's drawn, BITBASE_ILLEGAL when it
+ * can't arise, otherwise the number of plies to mate plus 1. Won positions
+ * have the strong side to move, lost ones the bare king.  */
+#define BITBASE_ILLEGAL 255
+
+/* Index of the position with the strong side's king on WK and piece on X and
+ * the bare king on BK, with STM to move. The strong side is always white
+ * here, so probes for black are flipped top to bottom.  */
+#define BITBASE_INDEX(stm, wk, bk, x)   ((((stm) * 64 + (wk)) * 64 + (bk)) * 64 \
+    + (x))
+
+void     bitbase_init (const char *);
+int      bitbase_load (const char *);
+void     bitbase_save (const char *);
+void     bitbase_generate (int);
+int      bitbase_legal (int, int, int, int, int);
+uint64_t bitbase_attacks (int, int, uint64_t);
+int      bitbase_white_wins (int, int, int, int, int);
+int      bitbase_black_loses (int, int, int, int, int);
+int      bitbase_probe (struct position *, int, int, int *);
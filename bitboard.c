@@ -0,0 +1,273 @@
+#include <string.h>
+#include "bitboard.h"
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+uint64_t knight_attacks[64];
+uint64_t king_attacks[64];
+uint64_t pawn_attacks[2][64];
+uint64_t between_bb[64][64];
+uint64_t line_bb[64][64];
+
+struct magic rook_magics[64];
+struct magic bishop_magics[64];
+
+/* Every square's attack sets are packed into one table per piece type. These
+ * are the totals of 2^(relevant blockers) over all 64 squares.  */
+uint64_t rook_table[102400];
+uint64_t bishop_table[5248];
+
+/* Magic numbers found by the search in init_magics, stored so that startup
+ * doesn't have to repeat it. The search only runs if one of them fails.  */
+const uint64_t rook_magic_numbers[64] = {
+    0x1080004008801020ULL, 0x0840092002c03000ULL, 0x1900200010400900ULL,
+    0x0880100008000480ULL, 0x4200100420080200ULL, 0x8100020100080400ULL,
+    0x0200040110886200ULL, 0x0200008040220411ULL, 0x0404800084400220ULL,
+    0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+    0x000a001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL,
+    0x0442000102105084ULL, 0x9080010020804100ULL, 0x0040404000201009ULL,
+    0x0000808010002009ULL, 0x2200090021d00100ULL, 0x0008008008040080ULL,
+    0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000a0001768104ULL,
+    0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL,
+    0x1000100080080080ULL, 0x0442000a00049020ULL, 0x2100040080020080ULL,
+    0x0800120400900148ULL, 0x0010040a00128541ULL, 0x2800804000800030ULL,
+    0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+    0x0400802402800800ULL, 0xc100020080800400ULL, 0x0002000802000401ULL,
+    0x0182085882000401ULL, 0x0220204000808000ULL, 0x2860100040024022ULL,
+    0x0001002004110040ULL, 0x99101042000a0020ULL, 0x0004080004008080ULL,
+    0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+    0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040a00300ULL,
+    0x0801100280080480ULL, 0x0242009008200600ULL, 0x1002000489500200ULL,
+    0x0040800200010080ULL, 0x0091800041000080ULL, 0x0000209300488001ULL,
+    0x04c1002414824001ULL, 0x020020000b001041ULL, 0x7000100004200901ULL,
+    0x8002002004100802ULL, 0x30010002084c0007ULL, 0x0888221800813004ULL,
+    0x4000002840840112ULL
+};
+
+const uint64_t bishop_magic_numbers[64] = {
+    0x10102002004a1420ULL, 0x8020040400584008ULL, 0x10510800811201c8ULL,
+    0x5204042080000088ULL, 0x2204106880000002ULL, 0x1401042004000000ULL,
+    0x0400880410042004ULL, 0x0028208200a02020ULL, 0x1500241990010e00ULL,
+    0x8001200182020a40ULL, 0x40004101030b0000ULL, 0x8002041042000100ULL,
+    0x4010011041020038ULL, 0x0000010421044000ULL, 0x1500210808020a00ULL,
+    0x8000088400880520ULL, 0x0405004010040100ULL, 0x1005823210040108ULL,
+    0x2708008102040011ULL, 0x4048200404009100ULL, 0x0018104101400024ULL,
+    0x0003000601190101ULL, 0x8004803108491000ULL, 0x8014241200820800ULL,
+    0x0006e080100c3040ULL, 0x0501044a11041800ULL, 0x9020300008004045ULL,
+    0x0894080000220040ULL, 0x1001010083104000ULL, 0x5004030040900080ULL,
+    0x000400422c012400ULL, 0x0002128698404812ULL, 0x1010108404900440ULL,
+    0x0928021182084100ULL, 0x2006080409020024ULL, 0x1010202020180080ULL,
+    0xa010008200202200ULL, 0x2098015100019004ULL, 0x0002041440810811ULL,
+    0x802a02020000b098ULL, 0x0009015090004060ULL, 0x4000821082081001ULL,
+    0x0100210040420800ULL, 0x0800004010488a00ULL, 0x2000081104004040ULL,
+    0x4c8e029015000082ULL, 0x0420340322224842ULL, 0x1298260043400210ULL,
+    0x0000822802400008ULL, 0x00008a0101600000ULL, 0x3040003412080021ULL,
+    0x3040290220884800ULL, 0x4a1500401041004aULL, 0x8010200282020781ULL,
+    0x0020203142209091ULL, 0x0070300600902110ULL, 0x0040808800b62048ULL,
+    0x0000810400c44420ULL, 0x00080400440c0441ULL, 0x8340080020840411ULL,
+    0x0000000104208200ULL, 0x0000800810d00080ULL, 0x0400530411080200ULL,
+    0x4040702400932244ULL
+};
+
+/* Piece directions as (file, rank) steps, used to build the tables.  */
+const int rook_dirs[4][2]   = { { 0, 1 }, { 1, 0 }, { 0, -1 }, { -1, 0 } };
+const int bishop_dirs[4][2] = { { 1, 1 }, { 1, -1 }, { -1, -1 }, { -1, 1 } };
+const int knight_dirs[8][2] = { { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 },
+    { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 } };
+const int king_dirs[8][2]   = { { 0, 1 }, { 1, 1 }, { 1, 0 }, { 1, -1 },
+    { 0, -1 }, { -1, -1 }, { -1, 0 }, { -1, 1 } };
+const int wpawn_dirs[2][2]  = { { -1, 1 }, { 1, 1 } };
+const int bpawn_dirs[2][2]  = { { -1, -1 }, { 1, -1 } };
+
+/* Fill every attack table. Must be called once before any other function in
+ * this file or any bitboard kept by board.c is used.  */
+void init_bitboards ()
+{
+    int sq;
+    for (sq = 0; sq < 64; sq++) {
+        knight_attacks[sq] = step_attacks (sq, knight_dirs, 8);
+        king_attacks[sq]   = step_attacks (sq, king_dirs, 8);
+        pawn_attacks[0][sq] = step_attacks (sq, wpawn_dirs, 2);
+        pawn_attacks[1][sq] = step_attacks (sq, bpawn_dirs, 2);
+    }
+
+    init_magics (rook_magics, rook_table, rook_dirs, rook_magic_numbers);
+    init_magics (bishop_magics, bishop_table, bishop_dirs,
+        bishop_magic_numbers);
+    init_lines ();
+}
+
+/* Fill BETWEEN_BB and LINE_BB from the slider attacks, which must be set up
+ * first. Squares between A and B are those attacked both from A with B
+ * blocking and from B with A blocking, and the line is what A and B attack
+ * in common on an empty board, plus A and B.  */
+void init_lines ()
+{
+    int a, b;
+    for (a = 0; a < 64; a++) {
+        for (b = 0; b < 64; b++) {
+            uint64_t ends = SQ_BIT (a) | SQ_BIT (b);
+            if (a != b && (rook_attacks (a, 0) & SQ_BIT (b))) {
+                between_bb[a][b] = rook_attacks (a, SQ_BIT (b))
+                    & rook_attacks (b, SQ_BIT (a));
+                line_bb[a][b] = (rook_attacks (a, 0) & rook_attacks (b, 0))
+                    | ends;
+            } else if (a != b && (bishop_attacks (a, 0) & SQ_BIT (b))) {
+                between_bb[a][b] = bishop_attacks (a, SQ_BIT (b))
+                    & bishop_attacks (b, SQ_BIT (a));
+                line_bb[a][b] = (bishop_attacks (a, 0)
+                    & bishop_attacks (b, 0)) | ends;
+            } else {
+                between_bb[a][b] = line_bb[a][b] = 0;
+            }
+        }
+    }
+}
+
+/* Return the squares reached from SQ by a single step in each of the COUNT
+ * directions in DIRS.  */
+uint64_t step_attacks (int sq, const int (*dirs)[2], int count)
+{
+    uint64_t attacks = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        int file = (sq & 7) + dirs[i][0];
+        int rank = (sq >> 3) + dirs[i][1];
+        if (file >= 0 && file < 8 && rank >= 0 && rank < 8) {
+            attacks |= SQ_BIT (rank * 8 + file);
+        }
+    }
+    return attacks;
+}
+
+/* Return the squares a slider on SQ attacks along the four DIRS, stopping at
+ * (and including) the first square of each ray set in OCCUPIED. Only used to
+ * build the magic tables.  */
+uint64_t slow_slider_attacks (int sq, uint64_t occupied, const int (*dirs)[2])
+{
+    uint64_t attacks = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        int file = (sq & 7) + dirs[i][0];
+        int rank = (sq >> 3) + dirs[i][1];
+        while (file >= 0 && file < 8 && rank >= 0 && rank < 8) {
+            uint64_t bit = SQ_BIT (rank * 8 + file);
+            attacks |= bit;
+            if (occupied & bit) {
+                break;
+            }
+            file += dirs[i][0];
+            rank += dirs[i][1];
+        }
+    }
+    return attacks;
+}
+
+/* Small xorshift generator advancing the state in *SEED. Callers start from a
+ * fixed seed so startup is deterministic.  */
+uint64_t random_u64 (uint64_t *seed)
+{
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 0x2545f4914f6cdd1dULL;
+}
+
+/* Compute the blocker mask of every square for the slider moving along DIRS,
+ * find a magic number mapping each blocker subset to a unique slot (or one
+ * that shares an identical attack set) and fill TABLE. Each square's number
+ * in KNOWN is tried first.  */
+void init_magics (struct magic *magics, uint64_t *table, const int (*dirs)[2],
+    const uint64_t *known)
+{
+    static uint64_t occupancy[4096], reference[4096];
+    static int      epoch[4096];
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    int attempt = 0, sq;
+
+    memset (epoch, 0, sizeof (epoch));
+    for (sq = 0; sq < 64; sq++) {
+        struct magic *m = &magics[sq];
+
+        /* Edge squares never block anything further along a ray, so they
+         * are left out of the mask unless the piece sits on that edge.  */
+        uint64_t edges =
+            ((RANK_1_BB | RANK_8_BB) & ~(RANK_1_BB << (8 * (sq >> 3))))
+            | ((FILE_A_BB | FILE_H_BB) & ~(FILE_A_BB << (sq & 7)));
+        m->mask    = slow_slider_attacks (sq, 0, dirs) & ~edges;
+        m->shift   = 64 - bit_count (m->mask);
+        m->attacks = (sq == 0) ? table : magics[sq - 1].attacks
+            + (1 << (64 - magics[sq - 1].shift));
+
+        /* Enumerate every subset of the mask (Carry-Rippler) along with the
+         * attacks it produces.  */
+        int size = 0;
+        uint64_t b = 0;
+        do {
+            occupancy[size] = b;
+            reference[size] = slow_slider_attacks (sq, b, dirs);
+#ifdef __BMI2__
+            m->attacks[_pext_u64 (b, m->mask)] = reference[size];
+#endif
+            size++;
+            b = (b - m->mask) & m->mask;
+        } while (b);
+
+#ifndef __BMI2__
+        /* Try sparse random numbers until one maps every subset without a
+         * destructive collision. EPOCH marks which slots are filled for the
+         * current attempt so the table needn't be cleared each time.  */
+        int i = 0;
+        m->magic = known[sq];
+        while (i < size) {
+            while (bit_count ((m->mask * m->magic) >> 56) < 6) {
+                m->magic = random_u64 (&seed) & random_u64 (&seed)
+                    & random_u64 (&seed);
+            }
+
+            attempt++;
+            for (i = 0; i < size; i++) {
+                unsigned idx = (unsigned) (((occupancy[i] & m->mask) * m->magic)
+                    >> m->shift);
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m->attacks[idx] = reference[i];
+                } else if (m->attacks[idx] != reference[i]) {
+                    m->magic = 0;
+                    break;
+                }
+            }
+        }
+#endif
+    }
+}
+
+/* Return the index into a magic's attack table for occupancy OCCUPIED.  */
+#ifdef __BMI2__
+#define MAGIC_INDEX(m, occupied)    _pext_u64 ((occupied), (m)->mask)
+#else
+#define MAGIC_INDEX(m, occupied) \
+    (unsigned) ((((occupied) & (m)->mask) * (m)->magic) >> (m)->shift)
+#endif
+
+/* Return the squares attacked by a rook on SQ given OCCUPIED squares.  */
+uint64_t rook_attacks (int sq, uint64_t occupied)
+{
+    const struct magic *m = &rook_magics[sq];
+    return m->attacks[MAGIC_INDEX (m, occupied)];
+}
+
+/* Return the squares attacked by a bishop on SQ given OCCUPIED squares.  */
+uint64_t bishop_attacks (int sq, uint64_t occupied)
+{
+    const struct magic *m = &bishop_magics[sq];
+    return m->attacks[MAGIC_INDEX (m, occupied)];
+}
+
+/* Return the squares attacked by a queen on SQ given OCCUPIED squares.  */
+uint64_t queen_attacks (int sq, uint64_t occupied)
+{
+    return rook_attacks (sq, occupied) | bishop_attacks (sq, occupied);
+}
@@ -0,0 +1,63 @@
+#include <stdint.h>
+
+/* Bitboards use one bit per square, a1 = bit 0 through h8 = bit 63. These
+ * convert between 0x88 board indices and bitboard square numbers. Arguments
+ * are evaluated more than once.  */
+#define SQ64(pos)       (((pos) + ((pos) & 7)) >> 1)
+#define SQ88(sq)        ((sq) + ((sq) & ~7))
+#define SQ_BIT(sq)      (1ULL << (sq))
+
+#define FILE_A_BB       0x0101010101010101ULL
+#define FILE_H_BB       0x8080808080808080ULL
+#define RANK_1_BB       0x00000000000000ffULL
+#define RANK_3_BB       0x0000000000ff0000ULL
+#define RANK_6_BB       0x0000ff0000000000ULL
+#define RANK_8_BB       0xff00000000000000ULL
+
+/* Sliding attacks are looked up from a table shared by all squares. MASK holds
+ * the relevant blocker squares (board edges excluded), and the occupied bits
+ * under it are hashed to an index with MAGIC and SHIFT. When the compiler
+ * targets BMI2 the index is taken with PEXT instead and MAGIC is unused.  */
+struct magic {
+    uint64_t  mask;
+    uint64_t  magic;
+    uint64_t *attacks;
+    int       shift;
+};
+
+/* Attack tables for pieces whose moves don't depend on occupancy. PAWN_ATTACKS
+ * is indexed by the pawn owner's player number.  */
+extern uint64_t knight_attacks[64];
+extern uint64_t king_attacks[64];
+extern uint64_t pawn_attacks[2][64];
+
+/* For two squares on a rank, file or diagonal, BETWEEN_BB holds the squares
+ * strictly between them and LINE_BB the whole line through them, edge to
+ * edge. Both are empty for squares that don't line up.  */
+extern uint64_t between_bb[64][64];
+extern uint64_t line_bb[64][64];
+
+/* Return the number of set bits in BB.  */
+static inline int bit_count (uint64_t bb)
+{
+    return __builtin_popcountll (bb);
+}
+
+/* Clear the lowest set bit of *BB and return its square.  */
+static inline int pop_lsb (uint64_t *bb)
+{
+    int sq = __builtin_ctzll (*bb);
+    *bb &= *bb - 1;
+    return sq;
+}
+
+void     init_bitboards ();
+void     init_lines ();
+void     init_magics (struct magic *, uint64_t *, const int (*)[2],
+    const uint64_t *);
+uint64_t slow_slider_attacks (int, uint64_t, const int (*)[2]);
+uint64_t step_attacks (int, const int (*)[2], int);
+uint64_t random_u64 (uint64_t *);
+uint64_t rook_attacks (int, uint64_t);
+uint64_t bishop_attacks (int, uint64_t);
+uint64_t queen_attacks (int, uint64_t);
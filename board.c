@@ -1,48 +1,329 @@
+#include <ctype.h>
 #include <stdio.h>
+#include <string.h>
+
+#include "bitboard.h"
 #include "board.h"
+#include "trace.h"
+
+/* The 0x88 layout means the difference between two squares identifies the
+ * direction between them uniquely. ATTACK_TABLE holds ATK_* flags for the
+ * pieces able to attack along each of the 240 possible differences and
+ * DELTA_TABLE the single step to walk along it. Both are indexed with
+ * ATK_INDEX.  */
+int attack_table[240];
+int delta_table[240];
+
+/* Material and piece-square tables from ai.c, summed into each position's
+ * evaluation totals.  */
+extern int material_table[13];
+extern int pst_table[13][64];
+
+/* Zobrist keys: a random number for each piece on each bitboard square, one
+ * for black to move, one for each set of castling rights and one for each file
+ * of the en passant square. A position's HASH_KEY is the XOR of the keys
+ * describing it. ZOBRIST_PIECE is indexed by piece value + 6.  */
+uint64_t zobrist_piece[13][64];
+uint64_t zobrist_black;
+uint64_t zobrist_castle[16];
+uint64_t zobrist_ep[8];
+
+/* Fill ATTACK_TABLE and DELTA_TABLE. Must be called once at startup.  */
+void init_attack_table ()
+{
+    int knight_steps[8] = { MOVE_K_URV, MOVE_K_URH, MOVE_K_DRH, MOVE_K_DRV,
+        MOVE_K_DLV, MOVE_K_DLH, MOVE_K_ULH, MOVE_K_ULV };
+    int king_steps[8] = { MOVE_UP, MOVE_DU_RIGHT, MOVE_RIGHT, MOVE_DD_RIGHT,
+        MOVE_DOWN, MOVE_DD_LEFT, MOVE_LEFT, MOVE_DU_LEFT };
+
+    int i;
+    for (i = 0; i < 240; i++) {
+        attack_table[i] = 0;
+        delta_table[i]  = 0;
+    }
+
+    /* Walk each ray from a square in the middle of the board. Any difference
+     * reached is valid from every square, since 0x88 differences don't wrap.  */
+    for (i = 0; i < 8; i++) {
+        int step = king_steps[i];
+        int flag = (i % 2 == 0) ? ATK_ROOK : ATK_BISHOP;
+        int dist;
+        for (dist = 1; dist < 8; dist++) {
+            attack_table[ATK_INDEX (0, step * dist)] |= flag;
+            delta_table[ATK_INDEX (0, step * dist)]   = step;
+        }
+        attack_table[ATK_INDEX (0, step)] |= ATK_KING;
+        attack_table[ATK_INDEX (0, knight_steps[i])] |= ATK_KNIGHT;
+        delta_table[ATK_INDEX (0, knight_steps[i])]   = knight_steps[i];
+    }
 
-int board[BOARD_SIZE];
-int wking_pos;
-int bking_pos;
-int checkmate;
+    attack_table[ATK_INDEX (0, MOVE_DU_RIGHT)] |= ATK_WPAWN;
+    attack_table[ATK_INDEX (0, MOVE_DU_LEFT)]  |= ATK_WPAWN;
+    attack_table[ATK_INDEX (0, MOVE_DD_RIGHT)] |= ATK_BPAWN;
+    attack_table[ATK_INDEX (0, MOVE_DD_LEFT)]  |= ATK_BPAWN;
+}
+
+/* Fill the Zobrist key tables. Must be called once at startup.  */
+void init_zobrist ()
+{
+    uint64_t seed = 0x2f6b93c4d1e8a507ULL;
+    int piece, sq;
+    for (piece = 0; piece < 13; piece++) {
+        for (sq = 0; sq < 64; sq++) {
+            zobrist_piece[piece][sq] = (piece == 6) ? 0 : random_u64 (&seed);
+        }
+    }
+    zobrist_black = random_u64 (&seed);
+
+    int i;
+    for (i = 0; i < 16; i++) {
+        zobrist_castle[i] = random_u64 (&seed);
+    }
+    for (i = 0; i < 8; i++) {
+        zobrist_ep[i] = random_u64 (&seed);
+    }
+}
 
 /* Place all pieces in default start position and reset game state.  */
-void reset_board () 
+void reset_board (struct position *position) 
 {
     /* Clear board completely, just fill it with null pieces.  */
     int i;
     for (i = 0; i < BOARD_SIZE; i++) {
-        board[i] = chp_null;
+        position->board[i] = chp_null;
     }
 
     /* Place black pawns in indices 96 - 103 and white pawns in 16 - 23.  */
     for (i = 16; i < 16 + 8; i++) {
-        board[i] = chp_wpawn;
-        board[i + 80] = chp_bpawn;
+        position->board[i] = chp_wpawn;
+        position->board[i + 80] = chp_bpawn;
     }
 
     /* Place major pieces for white in indicies 0 - 7, first row.  */
-    board[0] = board[7] = chp_wrook;
-    board[1] = board[6] = chp_wknight;
-    board[2] = board[5] = chp_wbishop;
-    board[3] = chp_wqueen;
-    board[4] = chp_wking;
+    position->board[0] = position->board[7] = chp_wrook;
+    position->board[1] = position->board[6] = chp_wknight;
+    position->board[2] = position->board[5] = chp_wbishop;
+    position->board[3] = chp_wqueen;
+    position->board[4] = chp_wking;
 
     /* Place major pieces for black in indicies 112 - 119, last row.  */
-    board[112] = board[119] = chp_brook;
-    board[113] = board[118] = chp_bknight;
-    board[114] = board[117] = chp_bbishop;
-    board[115] = chp_bqueen;  
-    board[116] = chp_bking;
+    position->board[112] = position->board[119] = chp_brook;
+    position->board[113] = position->board[118] = chp_bknight;
+    position->board[114] = position->board[117] = chp_bbishop;
+    position->board[115] = chp_bqueen;  
+    position->board[116] = chp_bking;
 
     /* Set WKING_POS and BKING_POS to starting positions.  */
-    wking_pos = 4;
-    bking_pos = 116;
-    checkmate = FALSE;
+    position->wking_pos = 4;
+    position->bking_pos = 116;
+    position->checkmate = FALSE;
+    position->castle_rights = CASTLE_ALL;
+    position->ep_square = NO_SQUARE;
+
+    sync_position (position);
+}
+
+/* Rebuild the bitboards, piece lists, hash key and evaluation totals from
+ * BOARD, CASTLE_RIGHTS and EP_SQUARE. Needed whenever they are written
+ * directly instead of through move_piece and unmove_piece. The key is
+ * computed for white to move.  */
+void sync_position (struct position *position)
+{
+    memset (position->piece_bb, 0, sizeof (position->piece_bb));
+    memset (position->side_bb, 0, sizeof (position->side_bb));
+    position->piece_count[WPLAYER] = position->piece_count[BPLAYER] = 0;
+    position->undo_count = 0;
+    position->hash_key = zobrist_castle[position->castle_rights];
+    if (position->ep_square != NO_SQUARE) {
+        position->hash_key ^= zobrist_ep[position->ep_square & 7];
+    }
+    position->material_total = position->pst_total = 0;
+
+    int i;
+    for (i = 0; i < BOARD_SIZE; i++) {
+        if (valid_x88_move (i) == TRUE && position->board[i] != chp_null) {
+            int player = PIECE_PLAYER (position->board[i]);
+            position->piece_bb[player][PIECE_TYPE (position->board[i])]
+                |= SQ_BIT (SQ64 (i));
+            position->side_bb[player] |= SQ_BIT (SQ64 (i));
+
+            position->piece_index[i] = position->piece_count[player];
+            position->piece_list[player][position->piece_count[player]++] = i;
+            account_piece (position, position->board[i], i, 1);
+        }
+    }
+}
+
+/* Set up the position described by the Forsyth-Edwards Notation string FEN.
+ * The move counters at the end are optional and ignored. Return the player to
+ * move, or -1 leaving the position unchanged if FEN can't be read or isn't a
+ * position the engine can hold: each side needs exactly one king and at most
+ * 16 pieces, and no pawn may stand on the first or last rank.  */
+int set_fen (struct position *position, const char *fen)
+{
+    const char *piece_chars = "pnbrqk";
+    int squares[BOARD_SIZE];
+    int rank = 7, file = 0, i;
+    int kings[2] = { NO_SQUARE, NO_SQUARE };
+    int pieces[2] = { 0, 0 };
+
+    /* Piece placement, rank 8 first.  */
+    memset (squares, 0, sizeof (squares));
+    for (; *fen != '\0' && *fen != ' '; fen++) {
+        if (*fen == '/') {
+            if (--rank < 0) {
+                return -1;
+            }
+            file = 0;
+        } else if (*fen >= '1' && *fen <= '8') {
+            file += *fen - '0';
+        } else {
+            const char *p = strchr (piece_chars, tolower (*fen));
+            if (p == NULL || file > 7) {
+                return -1;
+            }
+            int piece = p - piece_chars + 1;
+            if (islower (*fen)) {
+                piece = -piece;
+            }
+            if (++pieces[PIECE_PLAYER (piece)] > 16) {
+                return -1;
+            }
+            if (PIECE_TYPE (piece) == chp_wking) {
+                if (kings[PIECE_PLAYER (piece)] != NO_SQUARE) {
+                    return -1;
+                }
+                kings[PIECE_PLAYER (piece)] = rank * 16 + file;
+            }
+            if (PIECE_TYPE (piece) == chp_wpawn && (rank == 0 || rank == 7)) {
+                return -1;
+            }
+            squares[rank * 16 + file++] = piece;
+        }
+        if (file > 8) {
+            return -1;
+        }
+    }
+    if (kings[WPLAYER] == NO_SQUARE || kings[BPLAYER] == NO_SQUARE) {
+        return -1;
+    }
+
+    /* Player to move.  */
+    while (*fen == ' ') {
+        fen++;
+    }
+    int player = (*fen == 'w') ? WPLAYER : (*fen == 'b') ? BPLAYER : -1;
+    if (player < 0) {
+        return -1;
+    }
+    fen++;
+
+    /* Castling rights, or '-' for none.  */
+    int rights = 0;
+    while (*fen == ' ') {
+        fen++;
+    }
+    for (; *fen != '\0' && *fen != ' '; fen++) {
+        switch (*fen) {
+            case 'K': rights |= CASTLE_WK; break;
+            case 'Q': rights |= CASTLE_WQ; break;
+            case 'k': rights |= CASTLE_BK; break;
+            case 'q': rights |= CASTLE_BQ; break;
+        }
+    }
+
+    /* En passant square, or '-' for none.  */
+    int ep = NO_SQUARE;
+    while (*fen == ' ') {
+        fen++;
+    }
+    if (fen[0] >= 'a' && fen[0] <= 'h' && fen[1] >= '1' && fen[1] <= '8') {
+        ep = (fen[1] - '1') * 16 + (fen[0] - 'a');
+    }
+
+    for (i = 0; i < BOARD_SIZE; i++) {
+        position->board[i] = squares[i];
+    }
+    position->wking_pos = kings[WPLAYER];
+    position->bking_pos = kings[BPLAYER];
+    position->checkmate = FALSE;
+    position->castle_rights = rights;
+    position->ep_square = ep;
+    sync_position (position);
+    if (player == BPLAYER) {
+        position->hash_key ^= zobrist_black;
+    }
+    return player;
+}
+
+/* Write POSITION with PLAYER to move to FEN as Forsyth-Edwards Notation, the
+ * inverse of set_fen. FEN must hold FEN_SIZE characters. Move counters aren't
+ * kept, so they are always written as 0 1.  */
+void get_fen (struct position *position, int player, char *fen)
+{
+    const char *piece_chars = "kqrbnp PNBRQK";
+    int rank, file;
+
+    for (rank = 7; rank >= 0; rank--) {
+        int empty = 0;
+        for (file = 0; file < 8; file++) {
+            int piece = position->board[rank * 16 + file];
+            if (piece == chp_null) {
+                empty++;
+                continue;
+            }
+            if (empty > 0) {
+                *fen++ = '0' + empty;
+                empty = 0;
+            }
+            *fen++ = piece_chars[piece + 6];
+        }
+        if (empty > 0) {
+            *fen++ = '0' + empty;
+        }
+        *fen++ = (rank > 0) ? '/' : ' ';
+    }
+
+    *fen++ = (player == WPLAYER) ? 'w' : 'b';
+    *fen++ = ' ';
+    if (position->castle_rights == 0) {
+        *fen++ = '-';
+    }
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (position->castle_rights & (1 << i)) {
+            *fen++ = "KQkq"[i];
+        }
+    }
+
+    *fen++ = ' ';
+    if (position->ep_square == NO_SQUARE) {
+        *fen++ = '-';
+    } else {
+        *fen++ = 'a' + (position->ep_square & 7);
+        *fen++ = '1' + (position->ep_square >> 4);
+    }
+    strcpy (fen, " 0 1");
+}
+
+/* Write MOVE to STR in coordinate notation, such as e7e8q, which needs room
+ * for 6 characters.  */
+void move_string (int move, char *str)
+{
+    int start_pos = MOVE_START (move), end_pos = MOVE_END (move);
+    str[0] = (start_pos & 7) + 'a';
+    str[1] = (start_pos >> 4) + '1';
+    str[2] = (end_pos & 7) + 'a';
+    str[3] = (end_pos >> 4) + '1';
+    str[4] = '\0';
+    if (MOVE_PROMOTION (move) != 0) {
+        str[4] = "nbrq"[MOVE_PROMOTION (move) - chp_wknight];
+        str[5] = '\0';
+    }
 }
 
 /* Print a crude command line version of the board. Just for debugging.  */
-void print_board () 
+void print_board (struct position *position) 
 {
     /* Represent each piece by a character. Capitalized pieces are white.  */
     char piece_codes[] = { 'k', 'q', 'r', 'n', 'b', 'p', ' ', 'P', 'B', 'N', 
@@ -58,7 +339,8 @@ void print_board ()
     for (i = 112; i >= 0; i -= 16) {
         printf ("%d | ", row_num--);
         for (j = 0; j < 8; j++) {
-            printf ("%c | ", piece_codes[(chp_bking * -1) + board[i + j]]);
+            printf ("%c | ",
+                piece_codes[(chp_bking * -1) + position->board[i + j]]);
         }
         printf ("\n-----------------------------------\n");
     }
@@ -83,86 +365,266 @@ int square_on_board (int pos)
 }
 
 /* Return TRUE if the board contains any piece at index POS.  */
-int square_is_occupied (int pos) 
+int square_is_occupied (struct position *position, int pos) 
 {
-    return (board[pos] == chp_null) ? FALSE : TRUE;
+    return (position->board[pos] == chp_null) ? FALSE : TRUE;
 }
 
 /* Return TRUE if board contains a piece owned by PLAYER at index POS.  */
-int contains_players_piece (int player, int pos)
+int contains_players_piece (struct position *position, int player, int pos)
 {
-    if (player == WPLAYER && board[pos] > 0) {
+    if (player == WPLAYER && position->board[pos] > 0) {
         return TRUE;
-    } else if (player == BPLAYER && board[pos] < 0) {
+    } else if (player == BPLAYER && position->board[pos] < 0) {
         return TRUE;
     }
     return FALSE;
 }
 
-/* Perform checks on a move's legality and return TRUE if the move is made.  */
-int make_move (int player, int start_pos, int end_pos) 
+/* Perform checks on a move's legality and return TRUE if the move is made. A
+ * pawn reaching the last rank becomes a PROMOTION, or a queen if that's 0.  */
+int make_move (struct position *position, int player, int start_pos,
+    int end_pos, int promotion) 
 {
-    if (valid_start_pos (player, start_pos) == FALSE) {
+    if (valid_start_pos (position, player, start_pos) == FALSE) {
         return FALSE;
     }
     if (valid_end_pos (end_pos) == FALSE) {
         return FALSE;
     }
-    if (is_legal_move (player, start_pos, end_pos) == FALSE) {
+    int move = find_legal_move (position, player, start_pos, end_pos,
+        promotion);
+    if (move == 0) {
         return FALSE;
     }
 
-    move_piece (start_pos, end_pos);
-    if (player_in_check (opponent_player (player)) == TRUE) {
-        printf ("Move places opponent in check!\n");
+    /* Moves made in the game are never taken back, so they needn't stay on
+     * the undo stack.  */
+    move_piece (position, move);
+    position->undo_count = 0;
+    if (player_in_check (position, opponent_player (player)) == TRUE) {
+        TRACE (TRACE_MOVEGEN, "move places opponent in check");
     }
 
-    if (player_has_moves (opponent_player (player)) == FALSE) {
-        checkmate = TRUE;
+    if (player_has_moves (position, opponent_player (player)) == FALSE) {
+        position->checkmate = TRUE;
     }
 
     return TRUE;
 }
 
-/* Move piece from START_POS to END_POS and return the piece captured, if there
- * is one.  */
-int move_piece (int start_pos, int end_pos)
+/* Make MOVE, keeping the bitboards, piece lists, hash key and evaluation
+ * totals in step, and push what unmove_piece needs to take it back.  */
+void move_piece (struct position *position, int move)
+{
+    int start_pos = MOVE_START (move);
+    int end_pos   = MOVE_END (move);
+    int captured  = MOVE_CAPTURED (move);
+    int special   = MOVE_SPECIAL (move);
+    int moved     = position->board[start_pos];
+
+    struct undo *undo = &position->undo_stack[position->undo_count++];
+    undo->hash_key       = position->hash_key;
+    undo->castle_rights  = position->castle_rights;
+    undo->ep_square      = position->ep_square;
+    undo->material_total = position->material_total;
+    undo->pst_total      = position->pst_total;
+    undo->null_move      = FALSE;
+
+    if (position->ep_square != NO_SQUARE) {
+        position->hash_key ^= zobrist_ep[position->ep_square & 7];
+        position->ep_square = NO_SQUARE;
+    }
+
+    /* An en passant capture takes the pawn beside the start square.  */
+    if (captured != chp_null) {
+        int capture_pos = (special == MF_EN_PASSANT)
+            ? (start_pos & 0x70) | (end_pos & 7) : end_pos;
+        account_piece (position, captured, capture_pos, -1);
+        undo->capture_slot = lift_piece (position, capture_pos);
+    }
+
+    account_piece (position, moved, start_pos, -1);
+    shift_piece (position, start_pos, end_pos);
+    if (MOVE_PROMOTION (move) != 0) {
+        moved = (moved > 0) ? MOVE_PROMOTION (move) : -MOVE_PROMOTION (move);
+        change_piece (position, end_pos, moved);
+    }
+    account_piece (position, moved, end_pos, 1);
+
+    /* Castling is a king move of two squares, taking the rook along.  */
+    if (special == MF_CASTLE) {
+        int rook_start = (end_pos > start_pos) ? start_pos + 3 : start_pos - 4;
+        int rook_end   = (start_pos + end_pos) / 2;
+        account_piece (position, position->board[rook_start], rook_start, -1);
+        shift_piece (position, rook_start, rook_end);
+        account_piece (position, position->board[rook_end], rook_end, 1);
+    } else if (special == MF_DOUBLE_PUSH) {
+        position->ep_square = (start_pos + end_pos) / 2;
+        position->hash_key ^= zobrist_ep[position->ep_square & 7];
+    }
+
+    int rights = position->castle_rights & castle_mask (start_pos)
+        & castle_mask (end_pos);
+    if (rights != position->castle_rights) {
+        position->hash_key ^= zobrist_castle[position->castle_rights]
+            ^ zobrist_castle[rights];
+        position->castle_rights = rights;
+    }
+    position->hash_key ^= zobrist_black;
+}
+
+/* Take back MOVE, which must be the last move made by move_piece.  */
+void unmove_piece (struct position *position, int move)
+{
+    int start_pos = MOVE_START (move);
+    int end_pos   = MOVE_END (move);
+    int captured  = MOVE_CAPTURED (move);
+    int special   = MOVE_SPECIAL (move);
+    struct undo *undo = &position->undo_stack[--position->undo_count];
+
+    if (special == MF_CASTLE) {
+        int rook_start = (end_pos > start_pos) ? start_pos + 3 : start_pos - 4;
+        shift_piece (position, (start_pos + end_pos) / 2, rook_start);
+    }
+    if (MOVE_PROMOTION (move) != 0) {
+        change_piece (position, end_pos, (position->board[end_pos] > 0)
+            ? chp_wpawn : chp_bpawn);
+    }
+    shift_piece (position, end_pos, start_pos);
+    if (captured != chp_null) {
+        int capture_pos = (special == MF_EN_PASSANT)
+            ? (start_pos & 0x70) | (end_pos & 7) : end_pos;
+        drop_piece (position, captured, capture_pos, undo->capture_slot);
+    }
+
+    position->hash_key       = undo->hash_key;
+    position->castle_rights  = undo->castle_rights;
+    position->ep_square      = undo->ep_square;
+    position->material_total = undo->material_total;
+    position->pst_total      = undo->pst_total;
+    position->checkmate      = FALSE;
+}
+
+/* Pass the turn to the other player without moving, for null move pruning.
+ * Only the en passant square and the hash key change. Taken back by
+ * unmove_null.  */
+void move_null (struct position *position)
+{
+    struct undo *undo = &position->undo_stack[position->undo_count++];
+    undo->hash_key  = position->hash_key;
+    undo->ep_square = position->ep_square;
+    undo->null_move = TRUE;
+
+    if (position->ep_square != NO_SQUARE) {
+        position->hash_key ^= zobrist_ep[position->ep_square & 7];
+        position->ep_square = NO_SQUARE;
+    }
+    position->hash_key ^= zobrist_black;
+}
+
+/* Take back a pass made by move_null, which must have been the last move
+ * made.  */
+void unmove_null (struct position *position)
 {
-    int moved        = board[start_pos];
-    int attacked     = board[end_pos];
-    board[start_pos] = chp_null;
-    board[end_pos]   = moved;
+    struct undo *undo = &position->undo_stack[--position->undo_count];
+    position->hash_key  = undo->hash_key;
+    position->ep_square = undo->ep_square;
+}
 
-    if (board[end_pos] == chp_wking) {
-        wking_pos = end_pos;
-    } else if (board[end_pos] == chp_bking) {
-        bking_pos = end_pos;
+/* Return the castling rights kept when a piece moves to or from POS. Moving a
+ * king or rook from its starting square, or capturing a rook there, loses
+ * them.  */
+int castle_mask (int pos)
+{
+    switch (pos) {
+        case 0:   return CASTLE_ALL & ~CASTLE_WQ;
+        case 4:   return CASTLE_ALL & ~(CASTLE_WK | CASTLE_WQ);
+        case 7:   return CASTLE_ALL & ~CASTLE_WK;
+        case 112: return CASTLE_ALL & ~CASTLE_BQ;
+        case 116: return CASTLE_ALL & ~(CASTLE_BK | CASTLE_BQ);
+        case 119: return CASTLE_ALL & ~CASTLE_BK;
     }
+    return CASTLE_ALL;
+}
+
+/* Add PIECE at POS to the hash key and evaluation totals if SIGN is 1, or
+ * take it out if SIGN is -1.  */
+void account_piece (struct position *position, int piece, int pos, int sign)
+{
+    position->hash_key ^= zobrist_piece[piece + 6][SQ64 (pos)];
+    position->material_total += sign * material_table[piece + 6];
+    position->pst_total += sign * pst_table[piece + 6][SQ64 (pos)];
+}
 
-    return attacked;
+/* Remove the piece at POS from the board, bitboards and its owner's piece
+ * list. Return the list slot it had, for drop_piece.  */
+int lift_piece (struct position *position, int pos)
+{
+    int piece  = position->board[pos];
+    int player = PIECE_PLAYER (piece);
+    position->piece_bb[player][PIECE_TYPE (piece)] ^= SQ_BIT (SQ64 (pos));
+    position->side_bb[player] ^= SQ_BIT (SQ64 (pos));
+    position->board[pos] = chp_null;
+
+    int slot = position->piece_index[pos];
+    int last = position->piece_list[player][--position->piece_count[player]];
+    position->piece_list[player][slot] = last;
+    position->piece_index[last] = slot;
+    return slot;
 }
 
-/* Move piece from END_POS to START_POS and place OLD_PIECE in END_POS.  */
-void unmove_piece (int start_pos, int end_pos, int old_piece)
+/* Put PIECE back at POS, undoing the lift_piece that returned SLOT.  */
+void drop_piece (struct position *position, int piece, int pos, int slot)
 {
-    int moved        = board[end_pos];
-    board[start_pos] = moved;
-    board[end_pos]   = old_piece;
+    int player = PIECE_PLAYER (piece);
+    position->piece_bb[player][PIECE_TYPE (piece)] ^= SQ_BIT (SQ64 (pos));
+    position->side_bb[player] ^= SQ_BIT (SQ64 (pos));
+    position->board[pos] = piece;
+
+    int last = position->piece_list[player][slot];
+    position->piece_list[player][position->piece_count[player]] = last;
+    position->piece_index[last] = position->piece_count[player]++;
+    position->piece_list[player][slot] = pos;
+    position->piece_index[pos] = slot;
+}
 
-    if (board[start_pos] == chp_wking) {
-        wking_pos = start_pos;
-    } else if (board[start_pos] == chp_bking) {
-        bking_pos = start_pos;
+/* Move the piece at START_POS to the empty square END_POS.  */
+void shift_piece (struct position *position, int start_pos, int end_pos)
+{
+    int piece  = position->board[start_pos];
+    int player = PIECE_PLAYER (piece);
+    uint64_t bits = SQ_BIT (SQ64 (start_pos)) | SQ_BIT (SQ64 (end_pos));
+    position->piece_bb[player][PIECE_TYPE (piece)] ^= bits;
+    position->side_bb[player] ^= bits;
+    position->board[start_pos] = chp_null;
+    position->board[end_pos]   = piece;
+
+    position->piece_list[player][position->piece_index[start_pos]] = end_pos;
+    position->piece_index[end_pos] = position->piece_index[start_pos];
+
+    if (piece == chp_wking) {
+        position->wking_pos = end_pos;
+    } else if (piece == chp_bking) {
+        position->bking_pos = end_pos;
     }
+}
 
-    checkmate = FALSE;
+/* Replace the piece at POS with PIECE of the same player, for promotions.  */
+void change_piece (struct position *position, int pos, int piece)
+{
+    int player = PIECE_PLAYER (piece);
+    position->piece_bb[player][PIECE_TYPE (position->board[pos])]
+        ^= SQ_BIT (SQ64 (pos));
+    position->piece_bb[player][PIECE_TYPE (piece)] ^= SQ_BIT (SQ64 (pos));
+    position->board[pos] = piece;
 }
 
 /* Return TRUE if a move has valid START_POS and END_POS.  */
-int valid_start_pos (int player, int pos)
+int valid_start_pos (struct position *position, int player, int pos)
 {
     if (square_on_board (pos) == FALSE 
-        || contains_players_piece (player, pos) == FALSE) {
+        || contains_players_piece (position, player, pos) == FALSE) {
         //printf ("Error: invalid start_pos %d\n", pos);
         return FALSE;
     }
@@ -186,444 +648,555 @@ int opponent_player (int player)
     return (player == BPLAYER) ? WPLAYER : BPLAYER;
 }
 
-/* TRUE if move from START_POS to END_POS by PLAYER is legal.  */
-int is_legal_move (int player, int start_pos, int end_pos) 
+/* Return the packed legal move from START_POS to END_POS by PLAYER, or 0 if
+ * there isn't one. A pawn reaching the last rank promotes to PROMOTION, or a
+ * queen if that's 0.  */
+int find_legal_move (struct position *position, int player, int start_pos,
+    int end_pos, int promotion) 
+{
+    int legal_moves[MAX_PIECE_MOVES];
+    struct check_info checks;
+    find_checks (position, player, &checks);
+    int count = gen_legal_moves (position, player, start_pos, &checks,
+        legal_moves, 0);
+    if (promotion == 0) {
+        promotion = chp_wqueen;
+    }
+
+    int i;
+    for (i = 0; i < count; i++) {
+        if (MOVE_END (legal_moves[i]) == end_pos
+            && (MOVE_PROMOTION (legal_moves[i]) == 0
+                || MOVE_PROMOTION (legal_moves[i]) == promotion)) {
+            return legal_moves[i];
+        }
+    }
+
+    //printf ("Error: Illegal move %d - %d\n", start_pos, end_pos);
+    return 0;
+}
+
+/* Append the move from START_POS to END_POS to MOVES, which holds COUNT moves,
+ * and return the new count.  */
+int add_move (struct position *position, int *moves, int count, int start_pos,
+    int end_pos)
 {
-    int legal_moves[BOARD_SIZE];
-    init_moves_board (legal_moves);
+    moves[count] = PACK_MOVE (start_pos, end_pos, position->board[end_pos], 0);
+    return count + 1;
+}
 
-    gen_legal_moves (player, start_pos, legal_moves);
+/* Append a pawn move from START_POS to END_POS with FLAGS to MOVES, which
+ * holds COUNT moves, and return the new count. A pawn reaching the last rank
+ * adds one move for each piece it can promote to, best first.  */
+int add_pawn_move (struct position *position, int *moves, int count,
+    int start_pos, int end_pos, int flags)
+{
+    int captured = position->board[end_pos];
+    if (flags == MF_EN_PASSANT) {
+        captured = position->board[(start_pos & 0x70) | (end_pos & 7)];
+    }
 
-    if (legal_moves[end_pos] == FALSE) {
-        //printf ("Error: Illegal move %d - %d\n", start_pos, end_pos);
+    if ((end_pos >> 4) == 0 || (end_pos >> 4) == 7) {
+        int type;
+        for (type = chp_wqueen; type >= chp_wknight; type--) {
+            moves[count++] = PACK_MOVE (start_pos, end_pos, captured,
+                MF_PROMOTE (type));
+        }
+        return count;
     }
 
-    return legal_moves[end_pos];
+    moves[count] = PACK_MOVE (start_pos, end_pos, captured, flags);
+    return count + 1;
 }
 
-/* Generate legal moves for piece at START_POS and store in MOVES_ARRAY.  */
-void gen_legal_moves (int player, int start_pos, int *moves_array) 
+/* Fill MOVES with the legal moves of all PLAYER's pieces and return the
+ * count. What makes a move illegal is worked out once, by find_checks,
+ * rather than by making each move and testing for check.  */
+int gen_all_legal_moves (struct position *position, int player, int *moves)
 {
-    gen_plegal_moves (player, start_pos, moves_array);
-    remove_check_moves (player, start_pos, moves_array);
+    struct check_info checks;
+    int i, count = 0;
+
+    find_checks (position, player, &checks);
+    for (i = 0; i < position->piece_count[player]; i++) {
+        count = gen_legal_moves (position, player,
+            position->piece_list[player][i], &checks, moves, count);
+    }
+    return count;
 }
 
-/* Set moves leaving player in check to FALSE in MOVES_ARRAY.  */
-void remove_check_moves (int player, int start_pos, int *moves_array)
+/* Fill MOVES with the pseudo legal moves of all PLAYER's pieces and return the
+ * count.  */
+int gen_all_plegal_moves (struct position *position, int player, int *moves)
 {
-    int i;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if (moves_array[i] == TRUE) {
-            int attacked = move_piece (start_pos, i);
-            if (player_in_check (player) == TRUE) {
-                moves_array[i] = FALSE;
-            }
-            unmove_piece (start_pos, i, attacked);
+    int i, count = 0;
+    for (i = 0; i < position->piece_count[player]; i++) {
+        count = gen_plegal_moves (position, player,
+            position->piece_list[player][i], moves, count);
+    }
+    return count;
+}
+
+/* Fill MOVES with the pseudo legal captures and queen promotions of all
+ * PLAYER's pieces and return the count.  */
+int gen_all_plegal_captures (struct position *position, int player, int *moves)
+{
+    int i, count = gen_all_plegal_moves (position, player, moves), kept = 0;
+    for (i = 0; i < count; i++) {
+        if (MOVE_CAPTURED (moves[i]) != chp_null
+            || MOVE_PROMOTION (moves[i]) == chp_wqueen) {
+            moves[kept++] = moves[i];
+        }
+    }
+    return kept;
+}
+
+/* Append legal moves for piece at START_POS to MOVES, which holds COUNT moves,
+ * and return the new count. CHECKS must have been filled in by find_checks
+ * for PLAYER in POSITION.  */
+int gen_legal_moves (struct position *position, int player, int start_pos,
+    struct check_info *checks, int *moves, int count) 
+{
+    int sq = SQ64 (start_pos), first = count, kept = count, i;
+
+    if (sq == checks->king) {
+        return gen_legal_king_moves (position, player, start_pos, moves,
+            count);
+    }
+    if (checks->evasions == 0) {
+        return count;
+    }
+
+    uint64_t allowed = checks->evasions;
+    if (checks->pinned & SQ_BIT (sq)) {
+        allowed &= line_bb[checks->king][sq];
+    }
+    count = gen_plegal_moves (position, player, start_pos, moves, count);
+
+    /* Out of check, an unpinned piece can go anywhere it moves to. Taking en
+     * passant is always checked, since it empties two squares.  */
+    if (allowed == ~0ULL && position->ep_square == NO_SQUARE) {
+        return count;
+    }
+    for (i = first; i < count; i++) {
+        int move = moves[i];
+        int legal = (MOVE_SPECIAL (move) == MF_EN_PASSANT)
+            ? en_passant_legal (position, player, move, checks->king)
+            : (allowed & SQ_BIT (SQ64 (MOVE_END (move)))) != 0;
+        if (legal) {
+            moves[kept++] = move;
+        }
+    }
+    return kept;
+}
+
+/* Append the legal moves of PLAYER's king at START_POS to MOVES, which holds
+ * COUNT moves, and return the new count. The king may not step onto an
+ * attacked square. Attacks are found with the king lifted off the board, so
+ * it can't step back along the line of a slider checking it.
+ * Gen_castle_moves already checks the squares castling crosses.  */
+int gen_legal_king_moves (struct position *position, int player,
+    int start_pos, int *moves, int count)
+{
+    int opponent = opponent_player (player), first = count, kept = count, i;
+    uint64_t occupied = (position->side_bb[WPLAYER]
+        | position->side_bb[BPLAYER]) ^ SQ_BIT (SQ64 (start_pos));
+
+    count = gen_king_moves (position, player, start_pos, moves, count);
+    for (i = first; i < count; i++) {
+        int move = moves[i];
+        if (MOVE_SPECIAL (move) == MF_CASTLE
+            || attackers_to (position, SQ64 (MOVE_END (move)), opponent,
+                occupied) == 0) {
+            moves[kept++] = move;
+        }
+    }
+    return kept;
+}
+
+/* Return TRUE if PLAYER's en passant capture MOVE leaves its king, on the
+ * bitboard square KING, safe. The capture empties two squares on one row,
+ * which can expose the king along it even when neither pawn is pinned on
+ * its own, so the attacks on the king are worked out again for the board
+ * after the capture.  */
+int en_passant_legal (struct position *position, int player, int move,
+    int king)
+{
+    int taken = SQ64 ((MOVE_START (move) & 0x70) | (MOVE_END (move) & 7));
+    uint64_t occupied = ((position->side_bb[WPLAYER]
+        | position->side_bb[BPLAYER]) ^ SQ_BIT (SQ64 (MOVE_START (move)))
+        ^ SQ_BIT (taken)) | SQ_BIT (SQ64 (MOVE_END (move)));
+
+    return (attackers_to (position, king, opponent_player (player), occupied)
+        & ~SQ_BIT (taken)) == 0;
+}
+
+/* Fill CHECKS with what PLAYER's moves in POSITION must respect: the pieces
+ * checking its king, where its other pieces may go because of them and
+ * which are pinned to the king.  */
+void find_checks (struct position *position, int player,
+    struct check_info *checks)
+{
+    int opponent = opponent_player (player);
+    int king = SQ64 ((player == WPLAYER) ? position->wking_pos
+        : position->bking_pos);
+    uint64_t occupied = position->side_bb[WPLAYER]
+        | position->side_bb[BPLAYER];
+    uint64_t *pieces = position->piece_bb[opponent];
+
+    checks->king     = king;
+    checks->checkers = attackers_to (position, king, opponent, occupied);
+    checks->evasions = ~0ULL;
+    if (bit_count (checks->checkers) == 1) {
+        uint64_t checker = checks->checkers;
+        checks->evasions = checks->checkers
+            | between_bb[king][pop_lsb (&checker)];
+    } else if (checks->checkers != 0) {
+        checks->evasions = 0;
+    }
+
+    /* Sliders that would attack the king if PLAYER's own pieces were out of
+     * the way pin the one piece between them, if there's only one.  */
+    uint64_t snipers = (rook_attacks (king, position->side_bb[opponent])
+            & (pieces[chp_wrook] | pieces[chp_wqueen]))
+        | (bishop_attacks (king, position->side_bb[opponent])
+            & (pieces[chp_wbishop] | pieces[chp_wqueen]));
+    checks->pinned = 0;
+    while (snipers) {
+        uint64_t blockers = between_bb[king][pop_lsb (&snipers)] & occupied;
+        if (bit_count (blockers) == 1) {
+            checks->pinned |= blockers;
         }
     }
 }
 
-/* Generate pseudo legal moves at START_POS and store in MOVES_ARRAY.  */
-void gen_plegal_moves (int player, int start_pos, int *moves_array)
+/* Return PLAYER's pieces attacking the bitboard square SQ, with sliders
+ * blocked by the squares in OCCUPIED.  */
+uint64_t attackers_to (struct position *position, int sq, int player,
+    uint64_t occupied)
 {
-    switch (board[start_pos]) {
+    uint64_t *pieces = position->piece_bb[player];
+    return (pawn_attacks[opponent_player (player)][sq] & pieces[chp_wpawn])
+        | (knight_attacks[sq] & pieces[chp_wknight])
+        | (king_attacks[sq] & pieces[chp_wking])
+        | (bishop_attacks (sq, occupied)
+            & (pieces[chp_wbishop] | pieces[chp_wqueen]))
+        | (rook_attacks (sq, occupied)
+            & (pieces[chp_wrook] | pieces[chp_wqueen]));
+}
+
+/* Append pseudo legal moves at START_POS to MOVES and return the new count.  */
+int gen_plegal_moves (struct position *position, int player, int start_pos,
+    int *moves, int count)
+{
+    switch (position->board[start_pos]) {
         case chp_wpawn:
-            gen_wpawn_moves (start_pos, moves_array); 
-            break;
+            return gen_wpawn_moves (position, start_pos, moves, count); 
 
         case chp_bpawn:
-            gen_bpawn_moves (start_pos, moves_array);
-            break;
+            return gen_bpawn_moves (position, start_pos, moves, count);
 
         case chp_wknight:
         case chp_bknight:
-            gen_knight_moves (player, start_pos, moves_array);
-            break;
+            return gen_knight_moves (position, player, start_pos, moves, count);
 
         case chp_wking:
         case chp_bking:
-            gen_king_moves (player, start_pos, moves_array);
-            break;
+            return gen_king_moves (position, player, start_pos, moves, count);
 
         case chp_wrook:
         case chp_brook:
-            gen_rook_moves (player, start_pos, moves_array);
-            break;
+            return gen_rook_moves (position, player, start_pos, moves, count);
 
         case chp_wbishop:
         case chp_bbishop:
-            gen_bishop_moves (player, start_pos, moves_array);
-            break;
+            return gen_bishop_moves (position, player, start_pos, moves, count);
 
         case chp_wqueen:
         case chp_bqueen:
-            gen_queen_moves (player, start_pos, moves_array);
-            break;
+            return gen_queen_moves (position, player, start_pos, moves, count);
     }
+    return count;
 }
 
-/* Set each index of a legal move for white pawn in MOVES_ARRAY to TRUE.  */
-void gen_wpawn_moves (int start_pos, int *moves_array)
+/* Append each legal move for white pawn to MOVES and return the new count.  */
+int gen_wpawn_moves (struct position *position, int start_pos, int *moves,
+    int count)
 {
     /* Move up one if not blocked, two if first move.  */
     int up_one = MOVE_UP + start_pos;
     if ((up_one < BOARD_SIZE)
-        && (square_is_occupied (up_one) == FALSE)) {
-        moves_array[up_one] = TRUE;
+        && (square_is_occupied (position, up_one) == FALSE)) {
+        count = add_pawn_move (position, moves, count, start_pos, up_one, 0);
     }
 
     int up_two = MOVE_UP + up_one;
     if ((up_two < BOARD_SIZE)
         && (start_pos > 15 && start_pos < 24)
-        && (square_is_occupied (up_one) == FALSE)
-        && (square_is_occupied (up_two) == FALSE) ) {
-            moves_array[up_two] = TRUE;
+        && (square_is_occupied (position, up_one) == FALSE)
+        && (square_is_occupied (position, up_two) == FALSE) ) {
+            count = add_pawn_move (position, moves, count, start_pos, up_two,
+                MF_DOUBLE_PUSH);
     }
 
-    /* Attack right or left.  */
+    /* Attack right or left, or onto the en passant square.  */
     int up_right = MOVE_DU_RIGHT + start_pos;
     if ((up_right < BOARD_SIZE)
-        && (valid_x88_move (up_right))
-        && (board[up_right] <= chp_bpawn)) {
-        moves_array[up_right] = TRUE;
+        && (valid_x88_move (up_right))) {
+        if (position->board[up_right] <= chp_bpawn) {
+            count = add_pawn_move (position, moves, count, start_pos, up_right,
+                0);
+        } else if (up_right == position->ep_square) {
+            count = add_pawn_move (position, moves, count, start_pos, up_right,
+                MF_EN_PASSANT);
+        }
     }
 
     int up_left  = MOVE_DU_LEFT + start_pos;
     if ((up_left < BOARD_SIZE)
-        && (valid_x88_move (up_left))
-        && (board[up_left] <= chp_bpawn)) {
-        moves_array[up_left] = TRUE;
+        && (valid_x88_move (up_left))) {
+        if (position->board[up_left] <= chp_bpawn) {
+            count = add_pawn_move (position, moves, count, start_pos, up_left,
+                0);
+        } else if (up_left == position->ep_square) {
+            count = add_pawn_move (position, moves, count, start_pos, up_left,
+                MF_EN_PASSANT);
+        }
     } 
+    return count;
 }
 
-/* Set each index of a legal move for black pawn in MOVES_ARRAY to TRUE.  */
-void gen_bpawn_moves (int start_pos, int *moves_array)
+/* Append each legal move for black pawn to MOVES and return the new count.  */
+int gen_bpawn_moves (struct position *position, int start_pos, int *moves,
+    int count)
 {
     /* Move down one if not blocked, two if first move.  */
     int down_one = MOVE_DOWN + start_pos;
     if ((down_one >= 0)
-        && (square_is_occupied (down_one) == FALSE)) {
-        moves_array[down_one] = TRUE;
+        && (square_is_occupied (position, down_one) == FALSE)) {
+        count = add_pawn_move (position, moves, count, start_pos, down_one, 0);
     }
 
     int down_two = MOVE_DOWN + down_one;
     if ((down_two >= 0)
         && (start_pos > 95 && start_pos < 104)
-        && (square_is_occupied (down_one) == FALSE)
-        && (square_is_occupied (down_two) == FALSE) ) {
-            moves_array[down_two] = TRUE;
+        && (square_is_occupied (position, down_one) == FALSE)
+        && (square_is_occupied (position, down_two) == FALSE) ) {
+            count = add_pawn_move (position, moves, count, start_pos, down_two,
+                MF_DOUBLE_PUSH);
     }
 
-    /* Attack right or left.  */
+    /* Attack right or left, or onto the en passant square.  */
     int down_right = MOVE_DD_RIGHT + start_pos;
     if ((down_right >= 0)
-        && (valid_x88_move (down_right))
-        && (board[down_right] >= chp_wpawn)) {
-        moves_array[down_right] = TRUE;
+        && (valid_x88_move (down_right))) {
+        if (position->board[down_right] >= chp_wpawn) {
+            count = add_pawn_move (position, moves, count, start_pos,
+                down_right, 0);
+        } else if (down_right == position->ep_square) {
+            count = add_pawn_move (position, moves, count, start_pos,
+                down_right, MF_EN_PASSANT);
+        }
     }
 
     int down_left  = MOVE_DD_LEFT + start_pos;
     if ((down_left >= 0)
-        && (valid_x88_move (down_left))
-        && (board[down_left] >= chp_wpawn)) {
-        moves_array[down_left] = TRUE;
+        && (valid_x88_move (down_left))) {
+        if (position->board[down_left] >= chp_wpawn) {
+            count = add_pawn_move (position, moves, count, start_pos,
+                down_left, 0);
+        } else if (down_left == position->ep_square) {
+            count = add_pawn_move (position, moves, count, start_pos,
+                down_left, MF_EN_PASSANT);
+        }
     } 
+    return count;
 }
 
-/* Set each index of a legal move for knight in MOVES_ARRAY to TRUE.  */
-void gen_knight_moves (int player, int start_pos, int *moves_array)
-{
-    /* White pieces have positive values, so black knight must move into a space
-     * with value >= 0. To make this more general, when PLAYER is white a legal
-     * move is into a space with value <= 0, since black pieces have negative
-     * value. Thus, multiply by -1 and we can use >= 0 for both.  */
-    int mod = (player == BPLAYER) ? 1 : -1;
-
-    if ((MOVE_K_URV + start_pos < BOARD_SIZE)
-        && (valid_x88_move (MOVE_K_URV + start_pos))
-        && (board[MOVE_K_URV + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_K_URV + start_pos] = TRUE;
-    }
-    if ((MOVE_K_URH + start_pos < BOARD_SIZE)
-        && (valid_x88_move (MOVE_K_URH + start_pos))
-        && (board[MOVE_K_URH + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_K_URH + start_pos] = TRUE;
-    }
-    if ((MOVE_K_ULH + start_pos < BOARD_SIZE)
-        && (valid_x88_move (MOVE_K_ULH + start_pos))
-        && (board[MOVE_K_ULH + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_K_ULH + start_pos] = TRUE;
-    }
-    if ((MOVE_K_ULV + start_pos < BOARD_SIZE)
-        && (valid_x88_move (MOVE_K_ULV + start_pos))
-        && (board[MOVE_K_ULV + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_K_ULV + start_pos] = TRUE;
-    }
-    if ((MOVE_K_DRH + start_pos >= 0)
-        && (valid_x88_move (MOVE_K_DRH + start_pos))
-        && (board[MOVE_K_DRH + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_K_DRH + start_pos] = TRUE;
-    }
-    if ((MOVE_K_DRV + start_pos >= 0)
-        && (valid_x88_move (MOVE_K_DRV + start_pos))
-        && (board[MOVE_K_DRV + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_K_DRV + start_pos] = TRUE;
-    }
-    if ((MOVE_K_DLV + start_pos >= 0)
-        && (valid_x88_move (MOVE_K_DLV + start_pos))
-        && (board[MOVE_K_DLV + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_K_DLV + start_pos] = TRUE;
-    }
-    if ((MOVE_K_DLH + start_pos >= 0) 
-        && (valid_x88_move (MOVE_K_DLH + start_pos))
-        && (board[MOVE_K_DLH + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_K_DLH + start_pos] = TRUE;
-    }
-}
-
-/* Set each index of a legal move for king in MOVES_ARRAY to TRUE.  */
-void gen_king_moves (int player, int start_pos, int *moves_array)
+/* Append a move from START_POS to each square set in TARGETS to MOVES and
+ * return the new count.  */
+int gen_bb_moves (struct position *position, int start_pos, uint64_t targets,
+    int *moves, int count)
 {
-    /* White pieces have positive values, so black king must move into a space
-     * with value >= 0. To make this more general, when PLAYER is white a legal
-     * move is into a space with value <= 0, since black pieces have negative
-     * value. Thus, multiply by -1 and we can use >= 0 for both.  */
-    int mod = (player == BPLAYER) ? 1 : -1;
-    
-    if ((MOVE_UP + start_pos < BOARD_SIZE)
-        && (valid_x88_move (MOVE_UP + start_pos) == TRUE)
-        && (board[MOVE_UP + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_UP + start_pos] = TRUE;
-    }
-    if ((MOVE_RIGHT + start_pos < BOARD_SIZE)
-        && (valid_x88_move (MOVE_RIGHT + start_pos) == TRUE)
-        && (board[MOVE_RIGHT + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_RIGHT + start_pos] = TRUE;
-    }
-    if ((MOVE_DU_RIGHT + start_pos < BOARD_SIZE)
-        && (valid_x88_move (MOVE_DU_RIGHT + start_pos) == TRUE)
-        && (board[MOVE_DU_RIGHT + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_DU_RIGHT + start_pos] = TRUE;
-    }  
-    if ((MOVE_DU_LEFT + start_pos < BOARD_SIZE)
-        && (valid_x88_move (MOVE_DU_LEFT + start_pos) == TRUE)
-        && (board[MOVE_DU_LEFT + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_DU_LEFT + start_pos] = TRUE;
-    }
-    if ((MOVE_DOWN + start_pos >= 0)
-        && (valid_x88_move (MOVE_DOWN + start_pos) == TRUE)
-        && (board[MOVE_DOWN + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_DOWN + start_pos] = TRUE;
-    }
-    if ((MOVE_LEFT + start_pos >= 0)
-        && (valid_x88_move (MOVE_LEFT + start_pos) == TRUE)
-        && (board[MOVE_LEFT + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_LEFT + start_pos] = TRUE;
-    }
-    if ((MOVE_DD_RIGHT + start_pos >= 0)
-        && (valid_x88_move (MOVE_DD_RIGHT + start_pos) == TRUE)
-        && (board[MOVE_DD_RIGHT + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_DD_RIGHT + start_pos] = TRUE;
-    }
-    if ((MOVE_DD_LEFT + start_pos >= 0)
-        && (valid_x88_move (MOVE_DD_LEFT + start_pos) == TRUE)
-        && (board[MOVE_DD_LEFT + start_pos] * mod >= chp_null)) {
-        moves_array[MOVE_DD_LEFT + start_pos] = TRUE;
-    }
-}
-
-/* Set index of each legal move for a sliding piece to TRUE in MOVES_ARRAY.  */
-void gen_sliding_moves (int start_pos, int mod, int move_dir, int *moves_array)
-{ 
-    /* For each move direction, the move is legal if the space is empty. If the
-     * space contains an opponents piece, the move is legal and the loop breaks,
-     * since the piece is then blocked.  */
-    int i;
-    for (i = 1; i < 8; i++) {
-        int move = (move_dir * i) + start_pos;
-        if ((square_on_board (move)) && (valid_x88_move (move) == TRUE)) {
-            if (board[move] == chp_null) {
-                moves_array[move] = TRUE;
-            } else if (board[move] * mod > chp_null) {
-                moves_array[move] = TRUE;
-                break;
-            } else {
-                break;
-            }
-        } else {
-            break;
-        }
+    while (targets) {
+        int sq = pop_lsb (&targets);
+        count = add_move (position, moves, count, start_pos, SQ88 (sq));
     }
+    return count;
 }
 
-/* Generate legal moves in directions rook moves with GEN_SLIDING_MOVES.  */
-void gen_rook_moves (int player, int start_pos, int *moves_array)
-{
-    int mod = (player == BPLAYER) ? 1 : -1;
-    gen_sliding_moves (start_pos, mod, MOVE_UP, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DOWN, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_LEFT, moves_array);
-}
-
-/* Generate legal moves in directions bishop moves using GEN_SLIDING_MOVES.  */
-void gen_bishop_moves (int player, int start_pos, int *moves_array)
+/* Append each legal move for knight to MOVES and return the new count.  */
+int gen_knight_moves (struct position *position, int player, int start_pos,
+    int *moves, int count)
 {
-    int mod = (player == BPLAYER) ? 1 : -1;
-    gen_sliding_moves (start_pos, mod, MOVE_DU_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DD_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DD_LEFT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DU_LEFT, moves_array);
+    uint64_t targets = knight_attacks[SQ64 (start_pos)]
+        & ~position->side_bb[player];
+    return gen_bb_moves (position, start_pos, targets, moves, count);
 }
 
-/* Set each index of a legal move in MOVES_ARRAY to TRUE.  */
-void gen_queen_moves (int player, int start_pos, int *moves_array)
+/* Append each legal move for king to MOVES and return the new count.  */
+int gen_king_moves (struct position *position, int player, int start_pos,
+    int *moves, int count)
 {
-    int mod = (player == BPLAYER) ? 1 : -1;
-    gen_sliding_moves (start_pos, mod, MOVE_UP, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DOWN, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_LEFT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DU_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DD_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DD_LEFT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DU_LEFT, moves_array);
+    uint64_t targets = king_attacks[SQ64 (start_pos)]
+        & ~position->side_bb[player];
+    count = gen_bb_moves (position, start_pos, targets, moves, count);
+    if ((position->castle_rights >> (2 * player)) & (CASTLE_WK | CASTLE_WQ)) {
+        count = gen_castle_moves (position, player, start_pos, moves, count);
+    }
+    return count;
 }
 
-/* Return TRUE if PLAYER's king is in check.  */
-int player_in_check (int player)
+/* Append PLAYER's castling moves for the king at START_POS to MOVES and return
+ * the new count. The king may not castle out of, through or into check, and
+ * the squares between king and rook must be empty.  */
+int gen_castle_moves (struct position *position, int player, int start_pos,
+    int *moves, int count)
 {
-    int king_pos = (player == WPLAYER) ? wking_pos : bking_pos;
-    int mod = (player == BPLAYER) ? 1 : -1;
-    int moves_array[BOARD_SIZE];
+    int rights = position->castle_rights >> (2 * player);
+    int opponent = opponent_player (player);
+    int rook = (player == WPLAYER) ? chp_wrook : chp_brook;
 
-    if (player_check_by_pawn (king_pos, player) == TRUE) {
-        return TRUE;
+    if (start_pos != ((player == WPLAYER) ? 4 : 116)
+        || is_square_attacked (position, start_pos, opponent) == TRUE) {
+        return count;
     }
-    if (player_check_by_knight (king_pos, player, moves_array) == TRUE) {
-        return TRUE;
-    }
-    if (player_check_by_rook (king_pos, mod, moves_array) == TRUE) {
-        return TRUE;
-    }
-    if (player_check_by_bishop (king_pos, mod, moves_array) == TRUE) {
-        return TRUE;
+
+    if ((rights & CASTLE_WK)
+        && position->board[start_pos + 1] == chp_null
+        && position->board[start_pos + 2] == chp_null
+        && position->board[start_pos + 3] == rook
+        && is_square_attacked (position, start_pos + 1, opponent) == FALSE
+        && is_square_attacked (position, start_pos + 2, opponent) == FALSE) {
+        moves[count++] = PACK_MOVE (start_pos, start_pos + 2, chp_null,
+            MF_CASTLE);
     }
 
-    return FALSE;
+    if ((rights & CASTLE_WQ)
+        && position->board[start_pos - 1] == chp_null
+        && position->board[start_pos - 2] == chp_null
+        && position->board[start_pos - 3] == chp_null
+        && position->board[start_pos - 4] == rook
+        && is_square_attacked (position, start_pos - 1, opponent) == FALSE
+        && is_square_attacked (position, start_pos - 2, opponent) == FALSE) {
+        moves[count++] = PACK_MOVE (start_pos, start_pos - 2, chp_null,
+            MF_CASTLE);
+    }
+    return count;
 }
 
-/* Check if king at START_POS is in check by opponent's pawn.  */
-int player_check_by_pawn (int start_pos, int player)
+/* Append each legal rook move to MOVES and return the new count.  */
+int gen_rook_moves (struct position *position, int player, int start_pos,
+    int *moves, int count)
 {
-    if (player == WPLAYER) {
-        if ((board[MOVE_DU_RIGHT + start_pos] == chp_bpawn)
-            || (board[MOVE_DU_LEFT + start_pos] == chp_bpawn)) {
-            return TRUE;
-        }
-    } else {
-        if ((board[MOVE_DD_RIGHT + start_pos] == chp_wpawn)
-            || (board[MOVE_DD_LEFT + start_pos] == chp_wpawn)) {
-            return TRUE;
-        }
-    }
-    return FALSE;
+    uint64_t targets = rook_attacks (SQ64 (start_pos),
+        position->side_bb[0] | position->side_bb[1])
+        & ~position->side_bb[player];
+    return gen_bb_moves (position, start_pos, targets, moves, count);
 }
 
-/* Generate legal moves for king as if it were a knight and return TRUE if king
- * is in check by these pieces.  */
-int player_check_by_knight (int start_pos, int player, int *moves_array)
+/* Append each legal bishop move to MOVES and return the new count.  */
+int gen_bishop_moves (struct position *position, int player, int start_pos,
+    int *moves, int count)
 {
-    /* Pretend king is a knight and generate moves. If king can then attack an
-     * enemy's knight, king is in check.  */
-    init_moves_board (moves_array);
-    gen_knight_moves (player, start_pos, moves_array);
-    int mod = (player == BPLAYER) ? 1 : -1;
+    uint64_t targets = bishop_attacks (SQ64 (start_pos),
+        position->side_bb[0] | position->side_bb[1])
+        & ~position->side_bb[player];
+    return gen_bb_moves (position, start_pos, targets, moves, count);
+}
 
-    int i;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if ((moves_array[i] == TRUE) && (board[i] == chp_wknight * mod)) {
-            return TRUE;
-        }
-    }
-    return FALSE;
+/* Append each legal queen move to MOVES and return the new count.  */
+int gen_queen_moves (struct position *position, int player, int start_pos,
+    int *moves, int count)
+{
+    uint64_t targets = queen_attacks (SQ64 (start_pos),
+        position->side_bb[0] | position->side_bb[1])
+        & ~position->side_bb[player];
+    return gen_bb_moves (position, start_pos, targets, moves, count);
 }
 
-/* Generate legal moves for king as if it were a rook or queen and return TRUE
- * if king is in check by these pieces.  */
-int player_check_by_rook (int start_pos, int mod, int *moves_array)
+/* Return TRUE if PLAYER's king is in check.  */
+int player_in_check (struct position *position, int player)
 {
-    /* Pretend king is a rook/queen and generate moves. If king can then attack
-     * an enemy's rook/queen, king is in check.  */
-    init_moves_board (moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_UP, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DOWN, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_LEFT, moves_array);
+    int king_pos = (player == WPLAYER) ? position->wking_pos
+        : position->bking_pos;
+    return is_square_attacked (position, king_pos, opponent_player (player));
+}
 
-    int i;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if ((moves_array[i] == TRUE) 
-            && (board[i] == chp_wrook * mod || board[i] == chp_wqueen * mod)) {
-            return TRUE;
-        }
+/* Return the ATK_* flag matching the way PIECE attacks. Queens attack like
+ * both rooks and bishops.  */
+int piece_attack_flag (int piece)
+{
+    switch (piece) {
+        case chp_wpawn:
+            return ATK_WPAWN;
+        case chp_bpawn:
+            return ATK_BPAWN;
+        case chp_wknight:
+        case chp_bknight:
+            return ATK_KNIGHT;
+        case chp_wbishop:
+        case chp_bbishop:
+            return ATK_BISHOP;
+        case chp_wrook:
+        case chp_brook:
+            return ATK_ROOK;
+        case chp_wqueen:
+        case chp_bqueen:
+            return ATK_ROOK | ATK_BISHOP;
+        case chp_wking:
+        case chp_bking:
+            return ATK_KING;
     }
-    return FALSE;
+    return 0;
 }
 
-/* Generate legal moves for king as if it were a rook or queen and return TRUE
- * if king is in check by these pieces.  */
-int player_check_by_bishop (int start_pos, int mod, int *moves_array)
+/* Return TRUE if any of PLAYER's pieces attacks the square at POS. Each piece
+ * is first looked up in ATTACK_TABLE by its difference to POS, so only a
+ * slider that lines up with POS needs its one ray walked for blockers.  */
+int is_square_attacked (struct position *position, int pos, int player)
 {
-    /* Pretend king is a bishop/queen and generate moves. If king can then 
-     * attack an enemy's rook/queen, king is in check.  */
-    init_moves_board (moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DU_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DD_RIGHT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DD_LEFT, moves_array);
-    gen_sliding_moves (start_pos, mod, MOVE_DU_LEFT, moves_array);
+    uint64_t pieces = position->side_bb[player];
+    while (pieces) {
+        int sq   = pop_lsb (&pieces);
+        int from = SQ88 (sq);
+        int idx  = ATK_INDEX (from, pos);
+        int flag = attack_table[idx]
+            & piece_attack_flag (position->board[from]);
+        if (flag == 0) {
+            continue;
+        }
+        if ((flag & (ATK_ROOK | ATK_BISHOP)) == 0) {
+            return TRUE;
+        }
 
-    int i;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if ((moves_array[i] == TRUE) 
-            && (board[i] == chp_wbishop * mod 
-                || board[i] == chp_wqueen * mod)) {
+        int step = delta_table[idx], ray;
+        for (ray = from + step; ray != pos; ray += step) {
+            if (position->board[ray] != chp_null) {
+                break;
+            }
+        }
+        if (ray == pos) {
             return TRUE;
         }
     }
     return FALSE;
 }
 
-/* Fill MOVES_ARRAY with FALSE values.  */
-void init_moves_board (int *moves_array)
-{
-    int i;
-    for (i = 0; i < BOARD_SIZE; i++) {
-        moves_array[i] = FALSE;
-    }
-}
-
 /* Return TRUE if PLAYER has a legal move. This is strictly for detecting
  * checkmate, not for generating all legal moves a player has.  */
-int player_has_moves (int player)
+int player_has_moves (struct position *position, int player)
 {
-    int i, mod = (player == BPLAYER) ? -1 : 1;
-
-    /* If a board square contains a player's piece, generate all legal moves for
-     * that piece, then check if there are any legal moves. If there are, simply
-     * return TRUE. Else continue for all pieces.  */
-    for (i = 0; i < BOARD_SIZE; i++) {
-        if (board[i] * mod > chp_null) {
-            int moves_array[BOARD_SIZE];
-            init_moves_board (moves_array);
-            gen_legal_moves (player, i, moves_array);
-
-            int j;
-            for (j = 0; j < BOARD_SIZE; j++) {
-                if (moves_array[j] == TRUE) {
-                    return TRUE;
-                }
-            }
+    /* Generate all legal moves for each of the player's pieces. If there are
+     * any, simply return TRUE. Else continue for all pieces.  */
+    struct check_info checks;
+    int i;
+    find_checks (position, player, &checks);
+    for (i = 0; i < position->piece_count[player]; i++) {
+        int moves[MAX_PIECE_MOVES];
+        if (gen_legal_moves (position, player, position->piece_list[player][i],
+            &checks, moves, 0) > 0) {
+            return TRUE;
         }
     }
     
@@ -632,7 +1205,7 @@ int player_has_moves (int player)
 
 /* Return TRUE if the game has been won. No special checking for 50 move
  * draw or other special termination conditions currently implemented.  */
-int game_over () 
+int game_over (struct position *position) 
 {
-    return checkmate;
+    return position->checkmate;
 }
@@ -27,6 +27,69 @@
 #define MOVE_K_ULH      14
 #define MOVE_K_ULV      31
 
+/* Generated moves are packed into a single int and appended to a small fixed
+ * buffer by the gen_*_moves functions, which return the new move count. Bits
+ * 0 - 6 hold the start square, bits 7 - 13 the end square and bits 14 - 17 the
+ * captured piece (offset by 6 so it is never negative). Bits 18 - 19 mark
+ * special moves and bits 20 - 22 hold the type of piece a pawn promotes to,
+ * 0 if it doesn't. A move fits in 24 bits.  */
+#define MAX_MOVES       256
+#define MAX_PIECE_MOVES 32
+
+/* Most moves that can be made and not yet unmade at once.  */
+#define UNDO_SIZE       256
+
+#define PACK_MOVE(start, end, captured, flags) \
+    ((start) | ((end) << 7) | (((captured) + 6) << 14) | ((flags) << 18))
+#define MOVE_START(mv)      ((mv) & 0x7f)
+#define MOVE_END(mv)        (((mv) >> 7) & 0x7f)
+#define MOVE_CAPTURED(mv)   ((((mv) >> 14) & 0xf) - 6)
+#define MOVE_FLAGS(mv)      ((mv) >> 18)
+
+/* Special move kinds in the low flag bits. An en passant capture's captured
+ * piece is the pawn taken, which isn't on the end square. A double pawn push
+ * sets the en passant square.  */
+#define MF_CASTLE       1
+#define MF_EN_PASSANT   2
+#define MF_DOUBLE_PUSH  3
+#define MF_PROMOTE(type)    ((type) << 2)
+
+#define MOVE_SPECIAL(mv)    (MOVE_FLAGS (mv) & 3)
+#define MOVE_PROMOTION(mv)  (MOVE_FLAGS (mv) >> 2)
+
+/* Castling rights, one bit each for king and queen side per player, so a
+ * player's rights shifted down by 2 * PLAYER are CASTLE_WK | CASTLE_WQ.  */
+#define CASTLE_WK       1
+#define CASTLE_WQ       2
+#define CASTLE_BK       4
+#define CASTLE_BQ       8
+#define CASTLE_ALL      15
+
+/* EP_SQUARE when the last move wasn't a double pawn push.  */
+#define NO_SQUARE       -1
+
+/* Longest Forsyth-Edwards Notation string written by get_fen, with its null
+ * character.  */
+#define FEN_SIZE        96
+
+/* Flags in the 0x88 attack table for the kinds of piece that can attack along
+ * a square difference. Pawns get a flag per player since they attack in one
+ * direction only.  */
+#define ATK_WPAWN       0x01
+#define ATK_BPAWN       0x02
+#define ATK_KNIGHT      0x04
+#define ATK_BISHOP      0x08
+#define ATK_ROOK        0x10
+#define ATK_KING        0x20
+
+/* Index of the square difference TO - FROM in the attack tables.  */
+#define ATK_INDEX(from, to) ((to) - (from) + 119)
+
+/* The player owning PIECE and its type, which is the white piece's value (1
+ * for pawns through 6 for kings). Per-piece bitboards are indexed by these.  */
+#define PIECE_PLAYER(piece) (((piece) > 0) ? WPLAYER : BPLAYER)
+#define PIECE_TYPE(piece)   (((piece) > 0) ? (piece) : -(piece))
+
 /* Null piece is 0, white pieces range 1 to 6, black pieces from -1 to -6.  */
 enum ch_piece { 
     chp_null = 0,
@@ -46,35 +109,121 @@ enum ch_piece {
     chp_bking   = -6
 };
 
-void print_board ();
-void reset_board ();
-int  square_is_occupied (int);
+/* What move_piece changes that unmove_piece can't work out from the move
+ * itself.  */
+struct undo {
+    uint64_t hash_key;
+    int      castle_rights;
+    int      ep_square;
+    int      capture_slot;
+    int      material_total;
+    int      pst_total;
+    int      null_move;     /* TRUE for a pass made by move_null.  */
+};
+
+/* Everything about a position on the board. Positions can be copied by
+ * assignment, to hand one to another thread for instance.  */
+struct position {
+    int board[BOARD_SIZE];
+    int wking_pos;
+    int bking_pos;
+    int checkmate;
+
+    /* CASTLE_* rights still held, and the square a pawn that just moved two
+     * squares passed over (or NO_SQUARE).  */
+    int castle_rights;
+    int ep_square;
+
+    /* Bitboard copy of BOARD kept in sync by move_piece and unmove_piece.
+     * PIECE_BB is indexed by player and piece type, SIDE_BB holds all of a
+     * player's pieces. Index 0 of PIECE_BB is unused.  */
+    uint64_t piece_bb[2][7];
+    uint64_t side_bb[2];
+
+    /* Each player's pieces as a list of squares, also kept in sync by
+     * move_piece and unmove_piece. PIECE_INDEX maps an occupied square to its
+     * slot in its owner's list. A captured piece is removed by moving the
+     * list's last piece into its slot, and that slot is saved on the undo
+     * stack so unmove_piece can put both back exactly where they were.  */
+    int piece_list[2][16];
+    int piece_count[2];
+    int piece_index[BOARD_SIZE];
+
+    /* One entry for each move made by move_piece and not yet unmade.  */
+    struct undo undo_stack[UNDO_SIZE];
+    int undo_count;
+
+    /* Running totals of the material and piece-square tables over every
+     * piece, so evaluation needn't scan the board, and the Zobrist key.  */
+    int material_total;
+    int pst_total;
+    uint64_t hash_key;
+};
+
+/* What constrains a player's moves in a position, worked out once by
+ * find_checks for gen_legal_moves. KING is the player's king's bitboard
+ * square and CHECKERS the pieces attacking it. Pieces other than the king
+ * may only move to EVASIONS, which takes or blocks a lone checker (all
+ * squares when not in check, none in double check). PINNED pieces stand
+ * alone between the king and an enemy slider, and may only move along that
+ * line.  */
+struct check_info {
+    int      king;
+    uint64_t checkers;
+    uint64_t evasions;
+    uint64_t pinned;
+};
+
+void print_board (struct position *);
+void init_attack_table ();
+void init_zobrist ();
+void reset_board (struct position *);
+void sync_position (struct position *);
+int  set_fen (struct position *, const char *);
+void get_fen (struct position *, int, char *);
+void move_string (int, char *);
+int  square_is_occupied (struct position *, int);
 int  valid_x88_move (int);
 int  square_on_board (int);
-int  contains_players_piece (int, int);
-int  valid_start_pos (int, int);
+int  contains_players_piece (struct position *, int, int);
+int  valid_start_pos (struct position *, int, int);
 int  valid_end_pos (int);
 int  opponent_player (int);
-int  move_piece (int, int);
-void unmove_piece (int, int, int);
-void gen_legal_moves (int, int, int *); 
-void gen_plegal_moves (int, int, int *);
-void remove_check_moves (int, int, int *);
-void gen_wpawn_moves (int, int *);
-void gen_bpawn_moves (int, int *);
-void gen_knight_moves (int, int, int *);
-void gen_king_moves (int, int, int *);
-void gen_rook_moves (int, int, int *);
-void gen_bishop_moves (int, int, int *);
-void gen_queen_moves (int, int, int *);
-void gen_sliding_moves (int, int, int, int *);
-int  make_move (int, int, int);
-int  is_legal_move (int, int, int);
-int  player_in_check (int);
-int  player_check_by_rook (int, int, int *);
-int  player_check_by_bishop (int, int, int *);
-int  player_check_by_pawn (int, int);
-int  player_check_by_knight (int, int, int *);
-void init_moves_board (int *);
-int  player_has_moves (int);
-int  game_over ();
+void move_piece (struct position *, int);
+void unmove_piece (struct position *, int);
+void move_null (struct position *);
+void unmove_null (struct position *);
+int  castle_mask (int);
+void account_piece (struct position *, int, int, int);
+int  lift_piece (struct position *, int);
+void drop_piece (struct position *, int, int, int);
+void shift_piece (struct position *, int, int);
+void change_piece (struct position *, int, int);
+int  add_move (struct position *, int *, int, int, int);
+int  add_pawn_move (struct position *, int *, int, int, int, int);
+int  gen_all_legal_moves (struct position *, int, int *);
+int  gen_all_plegal_moves (struct position *, int, int *);
+int  gen_all_plegal_captures (struct position *, int, int *);
+int  gen_legal_moves (struct position *, int, int, struct check_info *,
+    int *, int);
+int  gen_legal_king_moves (struct position *, int, int, int *, int);
+int  en_passant_legal (struct position *, int, int, int);
+void find_checks (struct position *, int, struct check_info *);
+uint64_t attackers_to (struct position *, int, int, uint64_t);
+int  gen_plegal_moves (struct position *, int, int, int *, int);
+int  gen_wpawn_moves (struct position *, int, int *, int);
+int  gen_bpawn_moves (struct position *, int, int *, int);
+int  gen_knight_moves (struct position *, int, int, int *, int);
+int  gen_king_moves (struct position *, int, int, int *, int);
+int  gen_castle_moves (struct position *, int, int, int *, int);
+int  gen_rook_moves (struct position *, int, int, int *, int);
+int  gen_bishop_moves (struct position *, int, int, int *, int);
+int  gen_queen_moves (struct position *, int, int, int *, int);
+int  gen_bb_moves (struct position *, int, uint64_t, int *, int);
+int  make_move (struct position *, int, int, int, int);
+int  find_legal_move (struct position *, int, int, int, int);
+int  player_in_check (struct position *, int);
+int  is_square_attacked (struct position *, int, int);
+int  piece_attack_flag (int);
+int  player_has_moves (struct position *, int);
+int  game_over (struct position *);
@@ -0,0 +1,35 @@
+#define BOOK_KEYS           781
+#define BOOK_ENTRY_SIZE     16
+#define BOOK_START_KEY      0x463b96181691fc9cULL
+
+/* Offsets of the groups of keys in Polyglot's Random64 table. Piece keys are
+ * indexed 64 * kind + 8 * row + file, where kind is 2 * (piece type - 1),
+ * plus 1 for white pieces.  */
+#define BOOK_PIECE_KEYS     0
+#define BOOK_CASTLE_KEYS    768     /* White short, white long, black...  */
+#define BOOK_EP_KEYS        772     /* One per file.  */
+#define BOOK_TURN_KEY       780     /* Only when white is to move.  */
+
+/* An opening book in Polyglot's format, mapped into memory. ENTRIES holds
+ * COUNT entries of BOOK_ENTRY_SIZE bytes sorted by key, each a big-endian
+ * key (bytes 0 - 7), move (8 - 9), weight (10 - 11) and learning data
+ * (12 - 15), and is read where it lies rather than copied.
+ *
+ * A move packs the end file (bits 0 - 2) and row (3 - 5), the start file
+ * (6 - 8) and row (9 - 11) and a promotion piece (12 - 14), 1 for a knight to
+ * 4 for a queen. Castling is written as the king taking its own rook.  */
+struct book {
+    const unsigned char *entries;
+    size_t               count;
+    size_t               size;
+    uint64_t             seed;
+};
+
+int      book_check_keys ();
+int      book_open (const char *);
+void     book_close ();
+uint64_t book_key (struct position *, int);
+int      book_move (struct position *, int);
+size_t   book_find (uint64_t);
+uint64_t book_read (const unsigned char *, int);
+int      book_decode_move (struct position *, int, int);
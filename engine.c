@@ -1,51 +1,175 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "bitboard.h"
+#include "board.h"
 #include "ai.h"
 #include "engine.h"
-#include "board.h"
-
-FILE *fp;
-char  str_buff[BUF_SIZE];
-int   curr_player;
-extern int board[BOARD_SIZE];  /* From board.c, for debugging move evaluation.  */
+#include "batch.h"
+#include "bitbase.h"
+#include "book.h"
+#include "input.h"
+#include "log.h"
+#include "perft.h"
+#include "trace.h"
+#include "tt.h"
+
+/* Commands read by the input thread, from input.c.  */
+extern struct input_queue input_queue;
 
 /* XBoard starts engine from here.  */
 int main (int argc, char *argv[]) 
 {
-    /* Open a logging file that records everything received from XBoard and some
-     * output sent to XBoard.  */
-    fp = fopen ("iolog.txt", "w");
-    if (fp == NULL) {
+    static struct game main_game;
+    struct game *game = &main_game;
+    game->threads = 1;
+
+    /* Attack tables must be built before any board is set up.  */
+    init_bitboards ();
+    init_attack_table ();
+    init_zobrist ();
+    init_eval ();
+
+    /* -H <megabytes> sets the hash table size, -j <threads> the number of
+     * threads, -L <level> the log level, -B <file> the opening book, -T
+     * <file> where the endgame tables are cached and -P <name>=<value> one of
+     * the search's pruning parameters. They may precede any of the other
+     * arguments.  */
+    int hash_mb = TT_DEFAULT_MB, log_level = -1;
+    const char *book_path = NULL, *tables_path = NULL;
+    while (argc >= 3 && argv[1][0] == '-' && argv[1][1] != '\0'
+        && strchr ("HjLBTP", argv[1][1]) != NULL) {
+        switch (argv[1][1]) {
+            case 'H': hash_mb = atoi (argv[2]); break;
+            case 'j': game->threads = atoi (argv[2]); break;
+            case 'L': log_level = atoi (argv[2]); break;
+            case 'B': book_path = argv[2]; break;
+            case 'T': tables_path = argv[2]; break;
+            case 'P':
+                if (set_search_param (argv[2]) == FALSE) {
+                    printf ("Bad search parameter %s.\n", argv[2]);
+                    return -1;
+                }
+                break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    /* Open a logging file that records everything received from XBoard, some
+     * output sent to XBoard and how each search went. It's written in the
+     * background, see log.c, and read with logdump. Without -L only XBoard
+     * games are logged, so tests and benchmarks don't create the file or
+     * start the writer.  */
+    if (log_level < 0) {
+        log_level = (argc < 2) ? LOG_LEVEL_DEFAULT : LOG_LEVEL_OFF;
+    }
+    if (log_open (log_level) == FALSE) {
+        printf ("Couldn't open the log file.\n");
         return -1;
     }
 
-    /* XBoard suggests the following to fix buffering for I/O problems.  */
+    if (tt_init (hash_mb) == FALSE) {
+        printf ("Couldn't allocate a %d MB hash table.\n", hash_mb);
+        return -1;
+    }
+
+    /* Built before any search starts, so the searches don't wait for them and
+     * don't need a lock to probe them. Without a cache file they're generated
+     * every time, in under a second.  */
+    bitbase_init (tables_path);
+
+    if (book_path != NULL) {
+        if (book_check_keys () == FALSE) {
+            printf ("Polyglot's keys don't give the start position's key.\n");
+            return -1;
+        }
+        if (book_open (book_path) == FALSE) {
+            printf ("Couldn't open the book %s.\n", book_path);
+            return -1;
+        }
+    }
+
+    /* -b <depth> [nodes] analyses FEN lines from stdin to DEPTH plies, or
+     * without a depth limit if that's 0, and within NODES nodes if given.
+     * This comes before stdin and stdout are unbuffered for XBoard, since
+     * batches may be millions of lines long.  */
+    if (argc >= 3 && strncmp (argv[1], "-b", 2) == 0) {
+        struct search_limits limits = { atoi (argv[2]), 0, 1,
+            (argc > 3) ? atol (argv[3]) : 0 };
+        if (limits.depth <= 0 && limits.nodes <= 0) {
+            printf ("Give a depth or a node budget.\n");
+            return -1;
+        }
+        return (batch_analyse (stdin, stdout, &limits, game->threads) < 0)
+            ? -1 : 0;
+    }
+
+    /* XBoard suggests the following to fix buffering for I/O problems. Input
+     * is read a block at a time by a thread of its own instead, see
+     * input.c.  */
     setbuf (stdout, NULL);
-    setbuf (stdin, NULL);
 
     /* -c for command-line test game, 2-player.  */
     if (argc >= 2 && strncmp (argv[1], "-c", 2) == 0) {
-        play_test_game ();
+        if (input_start () == FALSE) {
+            return -1;
+        }
+        play_test_game (game);
         return 0;
     } 
 
     /* -a for command-line test game vs AI.  */
     else if (argc >= 2 && strncmp (argv[1], "-a", 2) == 0) {
-        play_ai_game ();
+        if (input_start () == FALSE) {
+            return -1;
+        }
+        play_ai_game (game);
         return 0;
     } 
 
     /* -t for a search test. Useful to check search time.  */
     else if (argc >= 2 && strncmp (argv[1], "-t", 2) == 0) {
-        search_test ();
+        search_test (game);
         return 0;
     } 
 
+    /* bench [depth] [json] searches a fixed set of positions, to check the
+     * speed and node counts of the search don't change unexpectedly.  */
+    else if (argc >= 2 && strcmp (argv[1], "bench") == 0) {
+        int depth = BENCH_DEPTH, json = FALSE, i;
+        for (i = 2; i < argc; i++) {
+            if (strcmp (argv[i], "json") == 0) {
+                json = TRUE;
+            } else if (atoi (argv[i]) > 0) {
+                depth = atoi (argv[i]);
+            }
+        }
+        bench_test (game, depth, json);
+        return 0;
+    }
+
+    /* -p <depth> [fen] counts the moves DEPTH plies deep from FEN, or from the
+     * start position, to check and time the move generator.  */
+    else if (argc >= 3 && strncmp (argv[1], "-p", 2) == 0) {
+        char fen[BUF_SIZE] = "";
+        int i;
+        for (i = 3; i < argc; i++) {
+            strncat (fen, argv[i], BUF_SIZE - strlen (fen) - 2);
+            strcat (fen, " ");
+        }
+        perft_test (game, atoi (argv[2]), (argc > 3) ? fen : NULL, hash_mb);
+        return 0;
+    }
+
     /* -e for an evaluation test. Displays material and positional scores for a
      * variety of board positions.  */
     else if (argc >= 2 && strncmp (argv[1], "-e", 2) == 0) {
-        eval_test ();
+        eval_test (game);
         return 0;
     } 
 
@@ -55,280 +179,745 @@ int main (int argc, char *argv[])
         printf ("\t-c play command line 2-player game\n");
         printf ("\t-a play command line 2-player game vs AI\n");
         printf ("\t-t run a test search\n");
+        printf ("\t-p <depth> [fen] count moves to depth from fen\n");
+        printf ("\t-b <depth> [nodes] analyse fen lines from stdin\n");
+        printf ("\tbench [depth] [json] time searches of fixed positions\n");
+        printf ("\t-H <mb> before any other argument sets the hash size\n");
+        printf ("\t-j <threads> before any other argument sets the threads\n");
+        printf ("\t-L <level> before any other argument sets the log level, "
+            "0 for none (by default only XBoard games are logged)\n");
+        printf ("\t-B <book> before any other argument sets a Polyglot book\n");
+        printf ("\t-T <file> before any other argument caches endgame tables "
+            "there\n");
+        printf ("\t-P <name>=<value> before any other argument sets a "
+            "search parameter\n");
         printf ("\tno arguments for regular XBoard game\n");
         return -1;
     } 
 
     /* No arguments usually means Rooked is being invoked by XBoard.  */
     else {
-        while (strncmp ("quit", str_buff, 4) != 0) { 
-            get_input ();
+        if (input_start () == FALSE) {
+            return -1;
+        }
+        while (strncmp ("quit", game->str_buff, 4) != 0) { 
+            get_input (game);
 
             /* XBoard requests new game.  */
-            if (strncmp ("new", str_buff, 3) == 0) { 
-                play_game ();
+            if (strncmp ("new", game->str_buff, 3) == 0) { 
+                play_game (game);
             } 
 
             /* Send features list to XBoard. Don't alter this, see XBoard
              * documentation if you want to send different features.  */ 
-            else if (strncmp ("protover 2", str_buff, 10) == 0) { 
-                printf ("feature myname=\"Rooked\" usermove=1 sigint=0 done=1\n");
+            else if (strncmp ("protover 2", game->str_buff, 10) == 0) { 
+                printf ("feature myname=\"Rooked\" usermove=1 sigint=0 "
+                    "memory=1 smp=1 done=1\n");
+            }
+
+            /* Settings may arrive before a game starts.  */
+            else {
+                setting_command (game);
             }
         }
     }
 
     /* Close logging file and exit cleanly.  */
-    fclose (fp);
+    log_close ();
     return 0;
 }
 
 /* Set all elements in the string buffer to the null character.  */
-void clean_buffer () 
+void clean_buffer (struct game *game) 
 {
     int i;
     for (i = 0; i < BUF_SIZE; i++) {
-        str_buff[i] = '\0';
+        game->str_buff[i] = '\0';
     }
 }
 
-/* Small function to read one character at a time and place it in the string
- * buffer, str_buff. It reads until the newline character (return key) is 
- * reached.  */
-void get_input () 
+/* Place the next line read by the input thread in the string buffer,
+ * str_buff, waiting for the newline character (return key) if need be.  */
+void get_input (struct game *game) 
 {
-    clean_buffer ();
-
-    int ch, i = 0;
-    while ((ch = getchar ()) != '\n') {
-        /* If XBoard sends an unusually large string, record it and print an
-         * error to the log file.  */
-        if (i > BUF_SIZE) {
-            fprintf (fp, "E: XBoard sent huge string:\n * %s", str_buff);
-            break;
+    clean_buffer (game);
+
+    /* If XBoard sends an unusually large string, record it and print an error
+     * to the log file.  */
+    if (input_read (game->str_buff) == TRUE) {
+        log_text (LOG_ERROR, "XBoard sent huge string: %s", game->str_buff);
+    }
+    log_text (LOG_RECEIVED, "%s", game->str_buff);
+}
+
+/* If STR_BUFF holds one of XBoard's time control commands, record it in
+ * TIME_CTL and return TRUE.  */
+int clock_command (struct game *game)
+{
+    struct time_control *time_ctl = &game->time_ctl;
+
+    /* level MPS BASE INC, where BASE is minutes or minutes:seconds and INC is
+     * seconds, possibly fractional.  */
+    if (strncmp ("level ", game->str_buff, 6) == 0) {
+        int mps = 0, minutes = 0, seconds = 0;
+        float inc = 0;
+        char base[32];
+        if (sscanf (game->str_buff + 6, "%d %31s %f", &mps, base, &inc) == 3) {
+            if (sscanf (base, "%d:%d", &minutes, &seconds) < 1) {
+                return TRUE;
+            }
+            time_ctl->moves_per_session = mps;
+            time_ctl->base_ms       = (minutes * 60 + seconds) * 1000;
+            time_ctl->increment_ms  = (int) (inc * 1000);
+            time_ctl->fixed_move_ms = 0;
+        }
+        return TRUE;
+    }
+
+    /* st SECONDS, an exact time for every move.  */
+    if (strncmp ("st ", game->str_buff, 3) == 0) {
+        time_ctl->fixed_move_ms = atoi (game->str_buff + 3) * 1000;
+        return TRUE;
+    }
+
+    /* time and otim give the clocks in centiseconds.  */
+    if (strncmp ("time ", game->str_buff, 5) == 0) {
+        time_ctl->engine_clock_ms = atoi (game->str_buff + 5) * 10;
+        return TRUE;
+    }
+    if (strncmp ("otim ", game->str_buff, 5) == 0) {
+        time_ctl->opponent_clock_ms = atoi (game->str_buff + 5) * 10;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* If STR_BUFF holds one of XBoard's commands changing a setting rather than
+ * the game, such as the time control, hash size, threads or thinking output,
+ * apply it and return TRUE.  */
+int setting_command (struct game *game)
+{
+    if (clock_command (game) == TRUE) {
+        return TRUE;
+    }
+
+    /* XBoard sets the hash table size in megabytes. The table can't be
+     * replaced under a search pondering.  */
+    if (strncmp ("memory ", game->str_buff, 7) == 0) {
+        if (game->pondering == TRUE) {
+            stop_pondering (game);
         }
-        str_buff[i++] = ch;
+        if (tt_init (atoi (game->str_buff + 7)) == FALSE) {
+            log_text (LOG_ERROR, "couldn't allocate %s MB",
+                game->str_buff + 7);
+        }
+        return TRUE;
+    }
+
+    /* XBoard sets the number of threads to search with.  */
+    if (strncmp ("cores ", game->str_buff, 6) == 0) {
+        game->threads = atoi (game->str_buff + 6);
+        return TRUE;
+    }
+
+    /* XBoard allows or forbids thinking on the opponent's time.  */
+    if (strncmp ("hard", game->str_buff, 4) == 0) {
+        game->ponder = TRUE;
+        return TRUE;
+    }
+    if (strncmp ("easy", game->str_buff, 4) == 0) {
+        game->ponder = FALSE;
+        return TRUE;
+    }
+
+    /* XBoard turns thinking output on and off.  */
+    if (strncmp ("post", game->str_buff, 4) == 0) {
+        game->search.post = TRUE;
+        return TRUE;
+    }
+    if (strncmp ("nopost", game->str_buff, 6) == 0) {
+        game->search.post = FALSE;
+        return TRUE;
     }
-    fprintf (fp, "R: %s\n", str_buff);
+
+    return FALSE;
+}
+
+/* Return the milliseconds the engine should spend on its next move. The time
+ * left is shared evenly among the moves to the next time control, plus most
+ * of the increment, and a bit more when the engine is ahead on the clock.  */
+int move_time_budget (struct game *game)
+{
+    struct time_control *time_ctl = &game->time_ctl;
+
+    if (time_ctl->fixed_move_ms > 0) {
+        int budget = time_ctl->fixed_move_ms - MOVE_OVERHEAD_MS;
+        return (budget > 10) ? budget : 10;
+    }
+
+    int remaining = (time_ctl->engine_clock_ms > 0) ? time_ctl->engine_clock_ms
+        : time_ctl->base_ms;
+    if (remaining <= 0) {
+        return DEFAULT_MOVE_MS;
+    }
+
+    int moves_left = MOVES_TO_GO;
+    if (time_ctl->moves_per_session > 0) {
+        moves_left = time_ctl->moves_per_session
+            - (time_ctl->moves_made % time_ctl->moves_per_session);
+    }
+
+    int budget = remaining / moves_left + time_ctl->increment_ms * 3 / 4;
+    if (time_ctl->opponent_clock_ms > 0
+        && remaining > time_ctl->opponent_clock_ms) {
+        budget += (remaining - time_ctl->opponent_clock_ms) / (2 * moves_left);
+    }
+
+    /* Never risk more than a third of the clock on one move.  */
+    if (budget > remaining / 3) {
+        budget = remaining / 3;
+    }
+    budget -= MOVE_OVERHEAD_MS;
+    return (budget > 10) ? budget : 10;
 }
 
 /* Clear the board of pieces, reset move counts and all state associated with
  * the previous game. Basically prepare for a totally new game.  */
-void init_game () 
+void init_game (struct game *game) 
 {
-    curr_player = WPLAYER;
-    reset_board ();
+    game->search.position = &game->position;
+    game->player = WPLAYER;
+    game->engine_player = BPLAYER;
+    game->time_ctl.moves_made = 0;
+    reset_board (&game->position);
 }
 
 /* Play a debugging/test game, controlling white and black. This is done via 
  * the command line, there is absolutely no GUI!  */
-void play_test_game ()
+void play_test_game (struct game *game)
 {
-    init_game ();
+    struct position *position = &game->position;
+    init_game (game);
 
-    while (game_over () == FALSE && strncmp ("quit", str_buff, 4) != 0) {
-        print_board ();
+    while (game_over (position) == FALSE
+        && strncmp ("quit", game->str_buff, 4) != 0) {
+        print_board (position);
 
         struct move mv;
         mv.start_pos = 0;
         mv.end_pos   = 0;
+        mv.promotion = 0;
 
         /* Get user's move then parse it from coordinate notation into an array
         index. Loop until the move is valid.  */
         do {
-            char pl = (curr_player == WPLAYER) ? 'W' : 'B';
+            char pl = (game->player == WPLAYER) ? 'W' : 'B';
             printf ("\nEnter %c move: ", pl);
-            get_input ();
+            get_input (game);
 
-            if (strncmp ("quit", str_buff, 4) == 0) {
+            if (strncmp ("quit", game->str_buff, 4) == 0) {
                 break;
             }
 
-            parse_move (&mv, FALSE);
-        } while (make_move (curr_player, mv.start_pos, mv.end_pos) == FALSE);
+            parse_move (game, &mv, FALSE);
+        } while (make_move (position, game->player, mv.start_pos, mv.end_pos,
+            mv.promotion) == FALSE);
 
-        curr_player = opponent_player (curr_player);
+        game->player = opponent_player (game->player);
     }
 
-    if (game_over () == TRUE) {
-        print_board ();
+    if (game_over (position) == TRUE) {
+        print_board (position);
         printf ("Checkmate!\n");
     }
 }
 
 /* Play a test game controlling white vs the AI.  */
-void play_ai_game ()
+void play_ai_game (struct game *game)
 {
-    fprintf (fp, "A: play_ai_game\n");
-    init_game ();
+    struct position *position = &game->position;
+    TRACE (TRACE_PROTOCOL, "play_ai_game");
+    init_game (game);
 
-    while (game_over () == FALSE && strncmp ("quit", str_buff, 4) != 0) { 
-        print_board ();
+    while (game_over (position) == FALSE
+        && strncmp ("quit", game->str_buff, 4) != 0) { 
+        print_board (position);
 
         struct move mv;
         mv.start_pos = 0;
         mv.end_pos   = 0;
+        mv.promotion = 0;
 
         /* Get user's move then parse it from coordinate notation into an array
         index. Loop until the move is valid.  */
         do {
             /* Get player's move or move from AI.  */
-            if (curr_player == WPLAYER) {
-                char pl = (curr_player == WPLAYER) ? 'W' : 'B';
+            if (game->player == WPLAYER) {
+                char pl = (game->player == WPLAYER) ? 'W' : 'B';
                 printf ("\nEnter %c move: ", pl);
-                get_input ();
+                get_input (game);
 
-                if (strncmp ("quit", str_buff, 4) == 0) {
+                if (strncmp ("quit", game->str_buff, 4) == 0) {
                     break;
                 }
-                parse_move (&mv, FALSE);
+                parse_move (game, &mv, FALSE);
             } else {
+                struct search_limits limits = { 0, DEFAULT_MOVE_MS,
+                    game->threads };
                 printf ("making AI's move\n");
-                fprintf (fp, "A: best_move\n");
-                best_move (&mv);
+                TRACE (TRACE_SEARCH, "best_move");
+                best_move (&game->search, game->player, &mv, &limits);
+                TRACE (TRACE_SEARCH, "%ld nodes, first-move cutoff rate %.1f%%",
+                    game->search.nodes, cutoff_rate (&game->search));
             }
-        } while (make_move (curr_player, mv.start_pos, mv.end_pos) == FALSE);
+        } while (make_move (position, game->player, mv.start_pos, mv.end_pos,
+            mv.promotion) == FALSE);
 
-        if (curr_player == BPLAYER) {
-            unparse_move (&mv);
-            printf ("move %s\n", str_buff);
+        if (game->player == BPLAYER) {
+            unparse_move (&mv, game->str_buff);
+            printf ("move %s\n", game->str_buff);
         }
 
-        curr_player = opponent_player (curr_player);
+        game->player = opponent_player (game->player);
     }
 
-    if (game_over () == TRUE) {
-        print_board ();
+    if (game_over (position) == TRUE) {
+        print_board (position);
         printf ("Checkmate!\n");
     }
 }
 
 /* Hook up with XBoard and play a game of chess :).  */
-void play_game () 
+void play_game (struct game *game) 
 {
-    fprintf (fp, "A: play_game\n");
-    extern int board[BOARD_SIZE];
-    init_game ();
+    struct position *position = &game->position;
+    TRACE (TRACE_PROTOCOL, "play_game");
+    init_game (game);
 
-    while (game_over () == FALSE && strncmp ("quit", str_buff, 4) != 0) { 
+    while (game_over (position) == FALSE
+        && strncmp ("quit", game->str_buff, 4) != 0) { 
         struct move mv;
         mv.start_pos = 0;
         mv.end_pos   = 0;
+        mv.promotion = 0;
 
         /* Get user's move then parse it from coordinate notation into an array
-         * index. Loop until the move is valid. AI moves when player is black,
-         * parse move into coordinate notation and send to XBoard.  */
+         * index. Loop until the move is valid. AI moves when it's the engine's
+         * turn, parse move into coordinate notation and send to XBoard.  */
         do {
-            /* Player's move. Take input from XBoard.  */
-            if (curr_player == WPLAYER) {
-                get_input ();
+            /* Player's move, or the engine is told to stop playing. Take
+             * input from XBoard.  */
+            if (game->player != game->engine_player
+                || input_aborted () == TRUE) {
+                get_input (game);
+
+                /* Pondering carries on through clock updates, and past the
+                 * opponent's move if it was the one expected.  */
+                if (game->pondering == TRUE
+                    && strncmp ("time ", game->str_buff, 5) != 0
+                    && strncmp ("otim ", game->str_buff, 5) != 0
+                    && strncmp ("usermove ", game->str_buff, 9) != 0) {
+                    stop_pondering (game);
+                }
 
-                if (strncmp ("quit", str_buff, 4) == 0) {
+                if (strncmp ("quit", game->str_buff, 4) == 0) {
                     break;
-                } else if (strncmp ("usermove ", str_buff, 9) == 0) { 
-                    parse_move (&mv, TRUE);
+                } else if (strncmp ("usermove ", game->str_buff, 9) == 0) { 
+                    parse_move (game, &mv, TRUE);
+                    /* XBoard's move carries no capture or special flags, so
+                     * only its squares and promotion are compared.  */
+                    if (game->pondering == TRUE
+                        && (mv.start_pos != MOVE_START (game->ponder_reply)
+                        || mv.end_pos != MOVE_END (game->ponder_reply)
+                        || mv.promotion
+                            != MOVE_PROMOTION (game->ponder_reply))) {
+                        stop_pondering (game);
+                    }
+                }
+
+                /* In force mode, and once the game's result is in, moves
+                 * for both sides come from XBoard until go.  */
+                else if (strncmp ("force", game->str_buff, 5) == 0
+                    || strncmp ("result", game->str_buff, 6) == 0) {
+                    game->engine_player = NO_PLAYER;
+                } else if (strncmp ("go", game->str_buff, 2) == 0) {
+                    game->engine_player = game->player;
+                } else if (strncmp ("new", game->str_buff, 3) == 0) {
+                    init_game (game);
+                } else {
+                    setting_command (game);
                 }
             }
 
-            /* AI's move. Send info to AI and store his move in BEST_MOVE.  */
+            /* On a ponder hit, the search already started goes on for as
+             * long as the clock allows.  */
+            else if (game->pondering == TRUE) {
+                finish_pondering (game, &mv);
+                TRACE (TRACE_SEARCH, "%ld nodes, first-move cutoff rate %.1f%%",
+                    game->search.nodes, cutoff_rate (&game->search));
+                log_search (game);
+            }
+
+            /* A move from the opening book is played at once.  */
+            else if (play_book_move (game, &mv) == TRUE) {
+                TRACE (TRACE_SEARCH, "book move %d - %d", mv.start_pos,
+                    mv.end_pos);
+            }
+
+            /* AI's move. Send info to AI and store his move in BEST_MOVE,
+             * searching for as long as the clock allows or until XBoard
+             * interrupts.  */
              else {
-                fprintf (fp, "A: best_move\n");
-                best_move (&mv);
+                struct search_limits limits = { 0, move_time_budget (game),
+                    game->threads, 0, &input_queue.interrupts };
+                TRACE (TRACE_SEARCH, "best_move in %d ms", limits.time_ms);
+                best_move (&game->search, game->player, &mv, &limits);
+                TRACE (TRACE_SEARCH, "%ld nodes, first-move cutoff rate %.1f%%",
+                    game->search.nodes, cutoff_rate (&game->search));
+                log_search (game);
+            }
+
+            /* A search interrupted by a command that ends the engine's part
+             * in the game has its move thrown away.  */
+            if (game->player == game->engine_player
+                && input_aborted () == TRUE) {
+                mv.start_pos = 0;
+                mv.end_pos   = 0;
+                mv.promotion = 0;
             }
-        } while (make_move (curr_player, mv.start_pos, mv.end_pos) == FALSE);
+        } while (make_move (position, game->player, mv.start_pos, mv.end_pos,
+            mv.promotion) == FALSE);
+
+        if (strncmp ("quit", game->str_buff, 4) == 0) {
+            break;
+        }
 
         /* Convert AI's move to coordinate notation and send move to XBoard.  */
-        if (curr_player == BPLAYER) {
-            unparse_move (&mv);
-            printf ("move %s\n", str_buff);
-            fprintf (fp, "A: sending \"move %s\"\n", str_buff);
+        if (game->player == game->engine_player) {
+            game->time_ctl.moves_made++;
+            unparse_move (&mv, game->str_buff);
+            printf ("move %s\n", game->str_buff);
+            TRACE (TRACE_PROTOCOL, "sending \"move %s\"", game->str_buff);
+            log_text (LOG_SENT, "move %s", game->str_buff);
         }
 
-        /* To help with making a better evaluation function, print contents of
-         * BOARD to log file.  */
-        fprintf (fp, "\n\n * --- *\n");
-        int i;
-        for (i = 0; i < BOARD_SIZE; i++) {
-            fprintf (fp, "%d", board[i]);
+        /* To help with making a better evaluation function, trace the
+         * position, which the -b mode can read back in. The FEN is only
+         * built when it will be traced.  */
+#if defined (TRACE_ENABLED) && (TRACE_CATEGORIES & TRACE_EVAL)
+        char fen[FEN_SIZE];
+        get_fen (position, opponent_player (game->player), fen);
+        TRACE (TRACE_EVAL, "%s", fen);
+#endif
+
+        game->player = opponent_player (game->player);
+        if (game->ponder == TRUE
+            && opponent_player (game->player) == game->engine_player
+            && game_over (position) == FALSE) {
+            start_pondering (game);
         }
-        fprintf (fp, "\n * --- *\n\n");
+    }
+
+    if (game->pondering == TRUE) {
+        stop_pondering (game);
+    }
+}
+
+/* If the opening book has a move for the engine, store it in MV and return
+ * TRUE.  */
+int play_book_move (struct game *game, struct move *mv)
+{
+    int move = book_move (&game->position, game->player);
+    if (move == 0) {
+        return FALSE;
+    }
+    mv->start_pos = MOVE_START (move);
+    mv->end_pos   = MOVE_END (move);
+    mv->promotion = MOVE_PROMOTION (move);
+    return TRUE;
+}
+
+/* Start searching, on a thread of its own, the position after the reply to
+ * the engine's move that the transposition table expects. Nothing is done
+ * if it expects none.  */
+void start_pondering (struct game *game)
+{
+    game->ponder_reply = hash_move (&game->position, game->player);
+    if (game->ponder_reply == 0) {
+        return;
+    }
+    TRACE (TRACE_SEARCH, "pondering %d - %d", MOVE_START (game->ponder_reply),
+        MOVE_END (game->ponder_reply));
+
+    game->ponder_player = opponent_player (game->player);
+    game->ponder_position = game->position;
+    move_piece (&game->ponder_position, game->ponder_reply);
+    game->search.position = &game->ponder_position;
+
+    /* The search control is set up here, so it can be stopped as soon as
+     * the thread exists.  */
+    struct search_limits limits = { 0, 0, game->threads, 0,
+        &input_queue.interrupts };
+    init_search (&game->search, &limits);
+    if (pthread_create (&game->ponder_thread, NULL, ponder_search, game)
+        != 0) {
+        game->search.position = &game->position;
+        return;
+    }
+    game->pondering = TRUE;
+}
+
+/* Thread body for start_pondering: search until stopped.  */
+void *ponder_search (void *arg)
+{
+    struct game *game = arg;
+    struct search_limits limits = { 0, 0, game->threads, 0,
+        &input_queue.interrupts };
+    run_search (&game->search, game->ponder_player, &game->ponder_mv,
+        &limits);
+    return NULL;
+}
+
+/* Abandon pondering, when the opponent didn't play the reply expected or
+ * the game is interrupted.  */
+void stop_pondering (struct game *game)
+{
+    stop_control (game->search.control);
+    pthread_join (game->ponder_thread, NULL);
+    game->search.position = &game->position;
+    game->pondering = FALSE;
+    TRACE (TRACE_SEARCH, "pondering stopped");
+}
 
-        curr_player = opponent_player (curr_player);
+/* The opponent played the reply expected, so give the search pondering it a
+ * deadline as if it had just started, and store its best move in MV. The
+ * time it has already spent is a bonus.  */
+void finish_pondering (struct game *game, struct move *mv)
+{
+    int budget = move_time_budget (game);
+    TRACE (TRACE_SEARCH, "ponder hit, %d ms more", budget);
+    set_stop_time (game->search.control, get_time_ms () + budget);
+    pthread_join (game->ponder_thread, NULL);
+    game->search.position = &game->position;
+    game->pondering = FALSE;
+    *mv = game->ponder_mv;
+}
+
+/* Log a summary of the last search: the depth reached, nodes searched and
+ * evaluated, time taken, how well moves were ordered, the effective
+ * branching factor and the transposition table hit rate.  */
+void log_search (struct game *game)
+{
+    struct search *search = &game->search;
+    struct log_search_data data;
+
+    if (log_enabled (LOG_SEARCH) == FALSE) {
+        return;
     }
+    data.nodes              = search->nodes;
+    data.evals              = search->evals;
+    data.beta_cutoffs       = search->beta_cutoffs;
+    data.first_move_cutoffs = search->first_move_cutoffs;
+    data.tt_probes          = search->tt_probes;
+    data.tt_hits            = search->tt_hits;
+    data.depth              = search->depth;
+    data.time_ms            = get_time_ms () - search->control->start;
+    data.branching          = (int) (search->branching * 100);
+    data.threads            = game->threads;
+    log_record (LOG_SEARCH, &data, sizeof (data));
 }
 
 /* Run a dummy search. Nice to checking how long it takes to search to some
  * depth.  */
-void search_test ()
+void search_test (struct game *game)
 {
-    printf ("Beginning search test to depth %d...\n", SEARCH_DEP);
-    init_game ();
-    abp_search (WPLAYER, SEARCH_DEP, NEG_INF, POS_INF);
+    struct search_limits limits = { TEST_DEPTH, 0, 1 };
+    printf ("Beginning search test to depth %d...\n", TEST_DEPTH);
+    init_game (game);
+    init_search (&game->search, &limits);
+    abp_search (&game->search, WPLAYER, TEST_DEPTH, 0, NEG_INF, POS_INF);
     printf ("End of search.\n");
+    printf ("%ld nodes, first-move cutoff rate %.1f%%\n", game->search.nodes,
+        cutoff_rate (&game->search));
 }
 
-/* Print material and position scores for a variety of test boards to learn more
- * about what the evaluation function is doing. Great for tuning.  */
-void eval_test ()
+/* Positions searched by bench_test: openings, middlegames, endgames and a few
+ * tactical and perft test positions.  */
+const char *bench_positions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+    "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+    "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+    "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+    "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+    "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+    "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+    "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+    "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+    "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+    "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+    "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+    "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+    "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+    "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+    "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124"
+};
+
+/* Search each of the bench positions to DEPTH on one thread and print the
+ * nodes and time each took, then the total nodes, which only change when the
+ * search does, and the speed. Each position starts with an empty hash table
+ * and fresh search state so the counts are reproducible. With JSON the
+ * results are printed as a JSON object instead, scores in centipawns as
+ * XBoard is sent them.  */
+void bench_test (struct game *game, int depth, int json)
 {
-    /* Board b2 has black's queen move into an insane position.  */
-    char *b1 = "4235632400000000111100110000000000000100000000000000100-5000000000000-1000000000000000000000000000-1-1-1-10-1-1-100000000-4-2-30-6-3-2-400000000x";
-    int c, i = 0, n = 0;
-    while ((c = b1[i]) != 'x') {
-        if (c == '-') {
-            c = b1[++i];
-            c = c - '0';
-            c *= -1;
-        } else {
-            c = c - '0';
-        }
-        board[n++] = c;
-        i++;
-    }
-    print_board ();
-    printf ("material score: %d\npositional score: %d\n", material_score (),
-        positional_score ());
-
-    /* Board b2 has black considering losing it's knight to a pawn.  */
-    char *b2 = "4235632400000000111101110000000000000000000000000000000000000000000000000000000000-20010000000000-1-1-1-1-1-1-1-100000000-40-3-5-6-30-400000000x";
-    i = 0; n = 0;
-    while ((c = b2[i]) != 'x') {
-        if (c == '-') {
-            c = b2[++i];
-            c = c - '0';
-            c *= -1;
-        } else {
-            c = c - '0';
+    int count = sizeof (bench_positions) / sizeof (bench_positions[0]), i;
+    long total_nodes = 0, total_ms = 0;
+
+    if (json == TRUE) {
+        printf ("{\n  \"depth\": %d,\n  \"positions\": [\n", depth);
+    }
+    for (i = 0; i < count; i++) {
+        struct search_limits limits = { depth, 0, 1, 0 };
+        struct move mv = { 0, 0, 0 };
+        char move[6] = "none";
+
+        init_game (game);
+        memset (&game->search, 0, sizeof (game->search));
+        game->search.position = &game->position;
+        game->player = set_fen (&game->position, bench_positions[i]);
+        tt_clear ();
+
+        long start = get_time_ms ();
+        int score = best_move (&game->search, game->player, &mv, &limits);
+        long elapsed = get_time_ms () - start;
+        if (mv.start_pos != mv.end_pos) {
+            unparse_move (&mv, move);
         }
-        board[n++] = c;
-        i++;
-    }
-    print_board ();
-    printf ("material score: %d\npositional score: %d\n",
-        material_score () * MATERIAL_WT, positional_score () * POSITION_WT);
-
-    /* Black moves to attack white's queen but loses bishop next move.  */
-    char *b3 = "420060240000000010100111000000000101300000000000000000500000000003-2-100000000000000-20000000000000-1-1-10-1-1-1-100000000-400-5-6-30-400000000";
-    i = 0; n = 0;
-    while ((c = b3[i]) != 'x') {
-        if (c == '-') {
-            c = b3[++i];
-            c = c - '0';
-            c *= -1;
+        total_nodes += game->search.nodes;
+        total_ms    += elapsed;
+
+        if (json == TRUE) {
+            printf ("    { \"fen\": \"%s\", \"move\": \"%s\", \"score\": %d, "
+                "\"nodes\": %ld, \"time_ms\": %ld }%s\n", bench_positions[i],
+                move, score / MATERIAL_WT, game->search.nodes, elapsed,
+                (i < count - 1) ? "," : "");
         } else {
-            c = c - '0';
+            printf ("%2d %-5s %10ld nodes %6ld ms  %s\n", i + 1, move,
+                game->search.nodes, elapsed, bench_positions[i]);
         }
-        board[n++] = c;
-        i++;
     }
-    print_board ();
-    printf ("material score: %d\npositional score: %d\n",
-        material_score () * MATERIAL_WT, positional_score () * POSITION_WT);
+
+    long nps = total_nodes * 1000 / (total_ms > 0 ? total_ms : 1);
+    if (json == TRUE) {
+        printf ("  ],\n  \"nodes\": %ld,\n  \"time_ms\": %ld,\n"
+            "  \"nps\": %ld\n}\n", total_nodes, total_ms, nps);
+    } else {
+        printf ("\nNodes: %ld\nTime: %ld ms\nNodes/sec: %ld\n", total_nodes,
+            total_ms, nps);
+    }
+}
+
+/* Print the number of move sequences DEPTH plies long from FEN, or from the
+ * start position if FEN is NULL, broken down by first move, and how fast they
+ * were counted. Counts are shared out among NUM_THREADS threads and cached in
+ * a HASH_MB megabyte table, or not cached if that's 0.  */
+void perft_test (struct game *game, int depth, const char *fen, int hash_mb)
+{
+    struct position *position = &game->position;
+    int moves[MAX_MOVES];
+    long leaves[MAX_MOVES], total = 0;
+
+    init_game (game);
+    if (fen != NULL && (game->player = set_fen (position, fen)) < 0) {
+        printf ("Couldn't read FEN \"%s\".\n", fen);
+        return;
+    }
+    if (depth < 1) {
+        printf ("Depth must be at least 1.\n");
+        return;
+    }
+
+    if (perft_hash_init (hash_mb) == FALSE) {
+        printf ("Couldn't allocate a %d MB perft hash table.\n", hash_mb);
+        return;
+    }
+
+    long start = get_time_ms ();
+    int count = gen_all_legal_moves (position, game->player, moves), i;
+    perft_divide (position, game->player, depth, moves, leaves, count,
+        game->threads);
+    long elapsed = get_time_ms () - start;
+
+    for (i = 0; i < count; i++) {
+        struct move mv = { MOVE_START (moves[i]), MOVE_END (moves[i]),
+            MOVE_PROMOTION (moves[i]) };
+        unparse_move (&mv, game->str_buff);
+        printf ("%s: %ld\n", game->str_buff, leaves[i]);
+        total += leaves[i];
+    }
+
+    printf ("\nNodes: %ld\nTime: %ld ms\nNodes/sec: %ld\n", total, elapsed,
+        total * 1000 / (elapsed > 0 ? elapsed : 1));
+    perft_hash_init (0);
+}
+
+/* Print material and position scores for a variety of test boards to learn more
+ * about what the evaluation function is doing. Great for tuning.  */
+void eval_test (struct game *game)
+{
+    struct position *position = &game->position;
+
+    /* In the first board black's queen has moved into an insane position. In
+     * the second black is considering losing its knight to a pawn, and in the
+     * third black moves to attack white's queen but loses a bishop next
+     * move.  */
+    const char *fens[] = {
+        "rnb1kbnr/pppp1ppp/8/4p3/4P2q/5P2/PPPP2PP/RNBQKBNR b KQkq - 0 1",
+        "r1bqkb1r/pppppppp/2n2P2/8/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1",
+        "r2qkb1r/ppp1pppp/2n5/1Bnp4/6Q1/1P1PB3/P1P2PPP/RN2K1NR b KQkq - 0 1"
+    };
+
+    int i;
+    for (i = 0; i < (int) (sizeof (fens) / sizeof (fens[0])); i++) {
+        set_fen (position, fens[i]);
+        print_board (position);
+        printf ("material score: %d\npositional score: %d\n",
+            material_score (position) * MATERIAL_WT,
+            positional_score (position) * POSITION_WT);
+    }
 }
 
 /* Convert coordinate notation of a move from STR_BUF to array index for
  * MV->START_POS and MV->END_POS.  */
-void parse_move (struct move *mv, int playing_xboard)
+void parse_move (struct game *game, struct move *mv, int playing_xboard)
 {
+    const char *str_buff = game->str_buff;
+
     if (playing_xboard == FALSE) {
         mv->start_pos = (str_buff[0] - 'a') + ((str_buff[1] - '1') * 16);
         mv->end_pos   = (str_buff[2] - 'a') + ((str_buff[3] - '1') * 16);
@@ -336,16 +925,21 @@ void parse_move (struct move *mv, int playing_xboard)
         mv->start_pos = (str_buff[9] - 'a') + ((str_buff[10] - '1') * 16);
         mv->end_pos   = (str_buff[11] - 'a') + ((str_buff[12] - '1') * 16);
     }
-    fprintf (fp, "A: parse_move to %d - %d\n", mv->start_pos, mv->end_pos);
+
+    /* A fifth character picks the piece a pawn promotes to.  */
+    const char *codes = "nbrq";
+    char code = str_buff[(playing_xboard == FALSE) ? 4 : 13];
+    const char *promotion = (code != '\0') ? strchr (codes, code) : NULL;
+    mv->promotion = (promotion != NULL) ? chp_wknight + (promotion - codes) : 0;
+    TRACE (TRACE_PROTOCOL, "parse_move to %d - %d", mv->start_pos,
+        mv->end_pos);
 }
 
-/* Convert MV->START_POS and MV->END_POS to coordinate notation in STR_BUFF.  */
-void unparse_move (struct move *mv)
+/* Convert MV->START_POS and MV->END_POS to coordinate notation in STR, which
+ * must have room for 6 characters.  */
+void unparse_move (struct move *mv, char *str)
 {
-    clean_buffer ();
-    str_buff[0] = (mv->start_pos & 7) + 'a';
-    str_buff[1] = (mv->start_pos >> 4) + '1';
-    str_buff[2] = (mv->end_pos & 7) + 'a';
-    str_buff[3] = (mv->end_pos >> 4) + '1';
-    fprintf (fp, "A: unparse_move to %s\n", str_buff);
+    move_string (PACK_MOVE (mv->start_pos, mv->end_pos, chp_null,
+        MF_PROMOTE (mv->promotion)), str);
+    TRACE (TRACE_PROTOCOL, "unparse_move to %s", str);
 }
@@ -1,12 +1,70 @@
 #define BUF_SIZE 128
 
-void clean_buffer ();
-void get_input ();
-void init_game ();
-void play_game ();
-void play_test_game ();
-void play_ai_game ();
-void search_test ();
-void eval_test ();
-void parse_move (struct move *, int);
-void unparse_move (struct move *);
+#define TEST_DEPTH          4       /* Depth of the -t search test.  */
+#define BENCH_DEPTH         5       /* Default depth of bench positions.  */
+#define DEFAULT_MOVE_MS     5000    /* Used when there's no time control.  */
+#define MOVES_TO_GO         30      /* Assumed when none is given.  */
+#define MOVE_OVERHEAD_MS    50      /* Kept in reserve for I/O delays.  */
+#define NO_PLAYER           -1      /* The engine's side in force mode.  */
+
+/* Time control sent by XBoard. All times are in milliseconds, 0 if not set.
+ * MOVES_PER_SESSION is 0 when the base time covers the whole game.  */
+struct time_control {
+    int moves_per_session;
+    int base_ms;
+    int increment_ms;
+    int fixed_move_ms;
+    int engine_clock_ms;
+    int opponent_clock_ms;
+    int moves_made;
+};
+
+/* Everything about the game being played: the position, the search state
+ * kept from move to move, the player to move and the clocks. STR_BUFF holds
+ * the last line read, or the last move written out. THREADS is the number of
+ * threads to search or run perft with. ENGINE_PLAYER is the side the engine
+ * plays, NO_PLAYER after XBoard's force command.
+ *
+ * PONDER is TRUE once XBoard's hard command allows thinking on the opponent's
+ * time. While PONDERING, PONDER_THREAD searches PONDER_POSITION, the position
+ * after the opponent's expected reply PONDER_REPLY, and stores PONDER_PLAYER's
+ * best answer to it in PONDER_MV.  */
+struct game {
+    struct position     position;
+    struct search       search;
+    struct time_control time_ctl;
+    int  player;
+    int  engine_player;
+    int  threads;
+    char str_buff[BUF_SIZE];
+
+    int             ponder;
+    int             pondering;
+    int             ponder_reply;
+    int             ponder_player;
+    pthread_t       ponder_thread;
+    struct position ponder_position;
+    struct move     ponder_mv;
+};
+
+void clean_buffer (struct game *);
+void get_input (struct game *);
+int  clock_command (struct game *);
+int  setting_command (struct game *);
+int  move_time_budget (struct game *);
+void init_game (struct game *);
+void play_game (struct game *);
+int  play_book_move (struct game *, struct move *);
+void start_pondering (struct game *);
+void *ponder_search (void *);
+void stop_pondering (struct game *);
+void finish_pondering (struct game *, struct move *);
+void play_test_game (struct game *);
+void play_ai_game (struct game *);
+void log_search (struct game *);
+void search_test (struct game *);
+void bench_test (struct game *, int, int);
+void perft_test (struct game *, int, const char *, int);
+void eval_test (struct game *);
+void parse_move (struct game *, struct move *, int);
+void unparse_move (struct move *, char *);
@@ -0,0 +1,138 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "ai.h"
+#include "engine.h"
+#include "input.h"
+
+struct input_queue input_queue;
+
+/* Start the thread reading stdin, after which lines are taken with
+ * input_read. Returns FALSE if it can't be started.  */
+int input_start ()
+{
+    pthread_t id;
+
+    sem_init (&input_queue.ready, 0, 0);
+    if (pthread_create (&id, NULL, input_reader, NULL) != 0) {
+        return FALSE;
+    }
+    pthread_detach (id);
+    return TRUE;
+}
+
+/* Thread body for input_start: read stdin a block at a time, split it into
+ * lines and queue them. Lines too long for the queue are cut short. When
+ * the input ends a quit command is queued, so the engine exits as if told
+ * to.  */
+void *input_reader (void *arg)
+{
+    char buf[INPUT_READ_SIZE], line[BUF_SIZE];
+    int length = 0, truncated = FALSE;
+    ssize_t count, i;
+    (void) arg;
+
+    while ((count = read (STDIN_FILENO, buf, sizeof (buf))) != 0) {
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (buf[i] == '\n') {
+                line[length] = '\0';
+                input_push (line, truncated);
+                length = 0;
+                truncated = FALSE;
+            } else if (length < BUF_SIZE - 1) {
+                line[length++] = buf[i];
+            } else {
+                truncated = TRUE;
+            }
+        }
+    }
+
+    input_push ("quit", FALSE);
+    return NULL;
+}
+
+/* Queue LINE, which was TRUNCATED if cut short, waiting for room if the main
+ * thread has fallen behind. Lines that should stop a search are counted
+ * before the line is published, so a search can stop on them at once.  */
+void input_push (const char *line, int truncated)
+{
+    unsigned long head = input_queue.head;
+    while (head - __atomic_load_n (&input_queue.tail, __ATOMIC_ACQUIRE)
+        == INPUT_QUEUE_SIZE) {
+        struct timespec wait = { 0, INPUT_FULL_WAIT_US * 1000 };
+        nanosleep (&wait, NULL);
+    }
+
+    int slot = head % INPUT_QUEUE_SIZE;
+    strcpy (input_queue.lines[slot], line);
+    input_queue.truncated[slot] = truncated;
+
+    int kind = input_stop_kind (line);
+    if (kind != INPUT_NO_STOP) {
+        __atomic_fetch_add (&input_queue.interrupts, 1, __ATOMIC_RELAXED);
+    }
+    if (kind == INPUT_ABORT) {
+        __atomic_fetch_add (&input_queue.aborts, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n (&input_queue.head, head + 1, __ATOMIC_RELEASE);
+    sem_post (&input_queue.ready);
+}
+
+/* Copy the next line read to LINE, which must hold BUF_SIZE characters,
+ * waiting for one if need be. Returns TRUE if the line was cut short.  */
+int input_read (char *line)
+{
+    while (sem_wait (&input_queue.ready) != 0) {
+    }
+
+    unsigned long tail = input_queue.tail;
+    int slot = tail % INPUT_QUEUE_SIZE;
+    strcpy (line, input_queue.lines[slot]);
+    int truncated = input_queue.truncated[slot];
+
+    int kind = input_stop_kind (line);
+    if (kind != INPUT_NO_STOP) {
+        __atomic_fetch_sub (&input_queue.interrupts, 1, __ATOMIC_RELAXED);
+    }
+    if (kind == INPUT_ABORT) {
+        __atomic_fetch_sub (&input_queue.aborts, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n (&input_queue.tail, tail + 1, __ATOMIC_RELEASE);
+    return truncated;
+}
+
+/* Return TRUE if a line waiting to be read means the engine shouldn't play
+ * the move it was searching for.  */
+int input_aborted ()
+{
+    return __atomic_load_n (&input_queue.aborts, __ATOMIC_RELAXED) > 0;
+}
+
+/* Return how the XBoard command LINE affects a search it arrives during:
+ * INPUT_MOVE_NOW for ?, INPUT_ABORT for commands that end the game or the
+ * engine's part in it and INPUT_NO_STOP for everything else.  */
+int input_stop_kind (const char *line)
+{
+    if (strcmp ("?", line) == 0) {
+        return INPUT_MOVE_NOW;
+    }
+    if (strncmp ("quit", line, 4) == 0 || strncmp ("force", line, 5) == 0
+        || strncmp ("new", line, 3) == 0 || strncmp ("result", line, 6) == 0) {
+        return INPUT_ABORT;
+    }
+    return INPUT_NO_STOP;
+}
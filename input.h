@@ -0,0 +1,35 @@
+#define INPUT_QUEUE_SIZE    64      /* Lines read ahead, a power of two.  */
+#define INPUT_READ_SIZE     4096    /* Bytes read from stdin at a time.  */
+#define INPUT_FULL_WAIT_US  1000    /* Time to wait for room in the queue.  */
+
+/* What a line read stops, if it arrives while the engine is searching.  */
+#define INPUT_NO_STOP       0
+#define INPUT_MOVE_NOW      1       /* Stop and play the best move found.  */
+#define INPUT_ABORT         2       /* Stop and throw the search away.  */
+
+/* Lines read from stdin by the input thread, waiting for the main thread.
+ * LINES is a ring indexed by line number modulo INPUT_QUEUE_SIZE, written
+ * only by the input thread, which advances HEAD, and read only by the main
+ * thread, which advances TAIL, so no lock is needed. READY counts the lines
+ * waiting, so the main thread can sleep until one arrives.
+ *
+ * INTERRUPTS counts the lines waiting that should stop a search, ABORTS those
+ * that should also throw its result away. A search is pointed at INTERRUPTS
+ * through its limits, so it stops as soon as such a line is read rather than
+ * when the main thread gets round to it.  */
+struct input_queue {
+    char          lines[INPUT_QUEUE_SIZE][BUF_SIZE];
+    int           truncated[INPUT_QUEUE_SIZE];
+    unsigned long head;
+    unsigned long tail;
+    sem_t         ready;
+    int           interrupts;
+    int           aborts;
+};
+
+int   input_start ();
+void *input_reader (void *);
+void  input_push (const char *, int);
+int   input_read (char *);
+int   input_aborted ();
+int   input_stop_kind (const char *);
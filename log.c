@@ -0,0 +1,185 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "board.h"
+#include "ai.h"
+#include "log.h"
+
+struct log_ring log_ring;
+int       log_level;
+long      log_start;
+FILE     *log_fp;
+pthread_t log_thread;
+
+/* The level at which each type of record is logged.  */
+const int log_type_level[LOG_TYPES] = { LOG_LEVEL_ERROR, LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG, LOG_LEVEL_DEBUG };
+
+/* Start logging records up to LEVEL to LOG_FILE, written out by a thread of
+ * its own. Nothing is started at LOG_LEVEL_OFF. Returns FALSE, leaving
+ * logging off, if the file can't be created or the thread started.  */
+int log_open (int level)
+{
+    uint32_t magic = LOG_MAGIC;
+    int i;
+
+    if (level <= LOG_LEVEL_OFF) {
+        return TRUE;
+    }
+    log_fp = fopen (LOG_FILE, "wb");
+    if (log_fp == NULL) {
+        return FALSE;
+    }
+    fwrite (&magic, sizeof (magic), 1, log_fp);
+
+    for (i = 0; i < LOG_RING_SIZE; i++) {
+        log_ring.slots[i].sequence = i;
+    }
+    log_start = get_time_ms ();
+    if (pthread_create (&log_thread, NULL, log_writer, NULL) != 0) {
+        fclose (log_fp);
+        log_fp = NULL;
+        return FALSE;
+    }
+    log_level = level;
+    atexit (log_close);
+    return TRUE;
+}
+
+/* Stop logging, once every record logged so far has been written out.  */
+void log_close ()
+{
+    if (log_fp == NULL) {
+        return;
+    }
+    log_level = LOG_LEVEL_OFF;
+    __atomic_store_n (&log_ring.closing, TRUE, __ATOMIC_RELEASE);
+    pthread_join (log_thread, NULL);
+    fclose (log_fp);
+    log_fp = NULL;
+}
+
+/* Thread body for log_open: write out records as they arrive, until
+ * log_close has been called and there are none left.  */
+void *log_writer (void *arg)
+{
+    (void) arg;
+    for (;;) {
+        int closing = __atomic_load_n (&log_ring.closing, __ATOMIC_ACQUIRE);
+        if (log_drain (log_fp) == 0) {
+            if (closing == TRUE) {
+                break;
+            }
+            fflush (log_fp);
+            struct timespec wait = { 0, LOG_IDLE_US * 1000 };
+            nanosleep (&wait, NULL);
+        }
+    }
+    fflush (log_fp);
+    return NULL;
+}
+
+/* Write the records waiting in the ring to FP, and note any that were
+ * dropped since last time. Returns the number written.  */
+int log_drain (FILE *fp)
+{
+    long dropped = __atomic_exchange_n (&log_ring.dropped, 0,
+        __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        char text[LOG_DATA_SIZE];
+        struct log_header header;
+        header.time   = get_time_ms () - log_start;
+        header.length = snprintf (text, sizeof (text),
+            "log full, %ld records dropped", dropped);
+        header.type   = LOG_ERROR;
+        header.unused = 0;
+        fwrite (&header, sizeof (header), 1, fp);
+        fwrite (text, 1, header.length, fp);
+    }
+
+    int count = 0;
+    for (;;) {
+        unsigned long pos = log_ring.tail;
+        struct log_slot *slot = &log_ring.slots[pos % LOG_RING_SIZE];
+        if (__atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+            break;
+        }
+
+        fwrite (&slot->header, sizeof (slot->header), 1, fp);
+        fwrite (slot->data, 1, slot->header.length, fp);
+        __atomic_store_n (&slot->sequence, pos + LOG_RING_SIZE,
+            __ATOMIC_RELEASE);
+        log_ring.tail = pos + 1;
+        count++;
+    }
+    return count;
+}
+
+/* Return TRUE if records of TYPE are being logged.  */
+int log_enabled (int type)
+{
+    return log_level >= log_type_level[type];
+}
+
+/* Log a record of TYPE holding the LENGTH bytes of DATA, truncated to
+ * LOG_DATA_SIZE. Safe to call from any thread, and never waits: the record
+ * is dropped if the ring is full.  */
+void log_record (int type, const void *data, int length)
+{
+    if (log_enabled (type) == FALSE) {
+        return;
+    }
+    if (length > LOG_DATA_SIZE) {
+        length = LOG_DATA_SIZE;
+    }
+
+    /* Claim the slot at HEAD, unless the writer hasn't freed it yet.  */
+    unsigned long pos = __atomic_load_n (&log_ring.head, __ATOMIC_RELAXED);
+    struct log_slot *slot;
+    for (;;) {
+        slot = &log_ring.slots[pos % LOG_RING_SIZE];
+        long diff = (long) (__atomic_load_n (&slot->sequence,
+            __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n (&log_ring.head, &pos, pos + 1,
+                TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add (&log_ring.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n (&log_ring.head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->header.time   = get_time_ms () - log_start;
+    slot->header.length = length;
+    slot->header.type   = type;
+    slot->header.unused = 0;
+    memcpy (slot->data, data, length);
+    __atomic_store_n (&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Log a line of text of TYPE, formatted from FORMAT like printf.  */
+void log_text (int type, const char *format, ...)
+{
+    char text[LOG_DATA_SIZE + 1];
+
+    if (log_enabled (type) == FALSE) {
+        return;
+    }
+    va_list args;
+    va_start (args, format);
+    int length = vsnprintf (text, sizeof (text), format, args);
+    va_end (args);
+    if (length > LOG_DATA_SIZE) {
+        length = LOG_DATA_SIZE;
+    }
+    log_record (type, text, length);
+}
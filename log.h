@@ -0,0 +1,76 @@
+#define LOG_FILE        "iolog.bin"
+#define LOG_MAGIC       0x474c4b52  /* "RKLG" at the start of LOG_FILE.  */
+#define LOG_RING_SIZE   1024        /* Records buffered, a power of two.  */
+#define LOG_DATA_SIZE   120         /* Longer text records are truncated.  */
+#define LOG_IDLE_US     10000       /* Writer's sleep when there's nothing.  */
+
+/* Log levels, each including those below it. Records above the level chosen
+ * are skipped before they're formatted, and at LOG_LEVEL_OFF the log file
+ * isn't even created.  */
+#define LOG_LEVEL_OFF       0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_INFO      2
+#define LOG_LEVEL_DEBUG     3
+#define LOG_LEVEL_DEFAULT   LOG_LEVEL_DEBUG
+
+/* Record types, and the letter logdump tags them with. All but LOG_SEARCH
+ * hold a line of text.  */
+#define LOG_ERROR       0   /* E: something went wrong.  */
+#define LOG_SEARCH      1   /* S: statistics of the engine's search.  */
+#define LOG_RECEIVED    2   /* R: a line from XBoard.  */
+#define LOG_SENT        3   /* W: a line written to XBoard.  */
+#define LOG_TYPES       4
+
+/* Each record in LOG_FILE is a header followed by LENGTH bytes of data. TIME
+ * counts milliseconds since the log was opened. Everything is written in the
+ * byte order of the machine writing it.  */
+struct log_header {
+    uint32_t time;
+    uint16_t length;
+    uint8_t  type;
+    uint8_t  unused;
+};
+
+/* The data of a LOG_SEARCH record, with the same meanings as the fields of
+ * struct search. BRANCHING is the effective branching factor times 100.  */
+struct log_search_data {
+    int64_t nodes;
+    int64_t evals;
+    int64_t beta_cutoffs;
+    int64_t first_move_cutoffs;
+    int64_t tt_probes;
+    int64_t tt_hits;
+    int32_t depth;
+    int32_t time_ms;
+    int32_t branching;
+    int32_t threads;
+};
+
+/* A record waiting in the ring buffer. SEQUENCE says whose turn the slot is:
+ * it equals the slot's next position for a producer to claim, and that
+ * position plus one once the record is there for the writer.  */
+struct log_slot {
+    unsigned long     sequence;
+    struct log_header header;
+    char              data[LOG_DATA_SIZE];
+};
+
+/* The log: a bounded ring shared without locks by any number of threads
+ * adding records, which claim slots by advancing HEAD, and the writer thread
+ * saving them, which advances TAIL. When the ring is full records are
+ * dropped rather than making the engine wait, and counted in DROPPED.  */
+struct log_ring {
+    struct log_slot slots[LOG_RING_SIZE];
+    unsigned long   head;
+    unsigned long   tail;
+    long            dropped;
+    int             closing;
+};
+
+int   log_open (int);
+void  log_close ();
+void *log_writer (void *);
+int   log_drain (FILE *);
+int   log_enabled (int);
+void  log_record (int, const void *, int);
+void  log_text (int, const char *, ...);
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+/* Print the binary log written by the engine as text, one record per line
+ * tagged with its time in seconds and type. Reads LOG_FILE, or the file
+ * given as the only argument.  */
+int main (int argc, char *argv[])
+{
+    const char *name = (argc > 1) ? argv[1] : LOG_FILE;
+    FILE *in = fopen (name, "rb");
+    if (in == NULL) {
+        printf ("Couldn't open %s.\n", name);
+        return -1;
+    }
+
+    uint32_t magic;
+    if (fread (&magic, sizeof (magic), 1, in) != 1 || magic != LOG_MAGIC) {
+        printf ("%s isn't a log file.\n", name);
+        return -1;
+    }
+
+    struct log_header header;
+    char data[LOG_DATA_SIZE];
+    while (fread (&header, sizeof (header), 1, in) == 1) {
+        if (header.type >= LOG_TYPES || header.length > LOG_DATA_SIZE
+            || fread (data, 1, header.length, in) != header.length) {
+            printf ("Corrupt record.\n");
+            return -1;
+        }
+        printf ("%4u.%03u %c: ", header.time / 1000, header.time % 1000,
+            "ESRW"[header.type]);
+
+        /* Search statistics are printed along with the rates following from
+         * them.  */
+        if (header.type == LOG_SEARCH) {
+            struct log_search_data stats, *s = &stats;
+            memcpy (s, data, sizeof (stats));
+            printf ("depth %d nodes %ld evals %ld time %d ms nps %ld "
+                "cutoffs %ld first %.1f%% ebf %.2f hash hits %.1f%% "
+                "threads %d\n", s->depth, (long) s->nodes, (long) s->evals,
+                s->time_ms, (long) (s->nodes * 1000 / (s->time_ms + 1)),
+                (long) s->beta_cutoffs, (s->beta_cutoffs == 0) ? 0.0
+                    : 100.0 * s->first_move_cutoffs / s->beta_cutoffs,
+                s->branching / 100.0, (s->tt_probes == 0) ? 0.0
+                    : 100.0 * s->tt_hits / s->tt_probes, s->threads);
+        } else {
+            printf ("%.*s\n", header.length, data);
+        }
+    }
+
+    fclose (in);
+    return 0;
+}
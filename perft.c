@@ -0,0 +1,131 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bitboard.h"
+#include "board.h"
+#include "perft.h"
+
+struct perft_entry *perft_table;
+uint64_t perft_mask;
+
+/* Allocate a perft hash table of at most MEGABYTES, rounded down to a power of
+ * two entries, replacing any previous one. 0 megabytes turns hashing off.
+ * Returns FALSE if the memory isn't available.  */
+int perft_hash_init (int megabytes)
+{
+    free (perft_table);
+    perft_table = NULL;
+    if (megabytes <= 0) {
+        return TRUE;
+    }
+
+    size_t entries = 1;
+    while (entries * 2 * sizeof (struct perft_entry)
+        <= (size_t) megabytes << 20) {
+        entries *= 2;
+    }
+    perft_table = calloc (entries, sizeof (struct perft_entry));
+    if (perft_table == NULL) {
+        return FALSE;
+    }
+    perft_mask = entries - 1;
+    return TRUE;
+}
+
+/* Return the number of move sequences DEPTH plies long from POSITION with
+ * PLAYER to move, the usual check of move generation against known counts.  */
+long perft (struct position *position, int player, int depth)
+{
+    int moves[MAX_MOVES];
+    long leaves = 0;
+    if (depth == 0) {
+        return 1;
+    }
+
+    /* The last ply is cheap enough that hashing it doesn't pay.  */
+    struct perft_entry *entry = NULL;
+    if (perft_table != NULL && depth > 1) {
+        entry = &perft_table[position->hash_key & perft_mask];
+        uint64_t check = __atomic_load_n (&entry->check, __ATOMIC_RELAXED);
+        uint64_t data  = __atomic_load_n (&entry->data, __ATOMIC_RELAXED);
+        if ((check ^ data) == position->hash_key
+            && (int) (data & 0xff) == depth) {
+            return data >> 8;
+        }
+    }
+
+    /* Only legal moves are generated, so the last ply's needn't be made
+     * to be counted.  */
+    int count = gen_all_legal_moves (position, player, moves), i;
+    if (depth == 1) {
+        return count;
+    }
+    for (i = 0; i < count; i++) {
+        move_piece (position, moves[i]);
+        leaves += perft (position, opponent_player (player), depth - 1);
+        unmove_piece (position, moves[i]);
+    }
+
+    if (entry != NULL) {
+        uint64_t data = ((uint64_t) leaves << 8) | depth;
+        __atomic_store_n (&entry->data, data, __ATOMIC_RELAXED);
+        __atomic_store_n (&entry->check, position->hash_key ^ data,
+            __ATOMIC_RELAXED);
+    }
+    return leaves;
+}
+
+/* Count the move sequences DEPTH plies long after each of the COUNT legal
+ * MOVES PLAYER can make in POSITION, storing them in LEAVES. The root moves
+ * are shared out among THREADS threads, each working on its own copy of the
+ * position.  */
+void perft_divide (struct position *position, int player, int depth,
+    int *moves, long *leaves, int count, int threads)
+{
+    pthread_t ids[PERFT_MAX_THREADS];
+    struct perft_job job;
+    int i;
+
+    job.root   = *position;
+    job.player = player;
+    job.depth  = depth;
+    job.moves  = moves;
+    job.leaves = leaves;
+    job.count  = count;
+    job.next   = 0;
+
+    if (threads > PERFT_MAX_THREADS) {
+        threads = PERFT_MAX_THREADS;
+    }
+    for (i = 1; i < threads; i++) {
+        if (pthread_create (&ids[i], NULL, perft_worker, &job) != 0) {
+            break;
+        }
+    }
+    threads = i;
+
+    /* This thread does its share too, on its own position.  */
+    perft_worker (&job);
+    for (i = 1; i < threads; i++) {
+        pthread_join (ids[i], NULL);
+    }
+}
+
+/* Thread body for perft_divide: count root moves from JOB until none are
+ * left.  */
+void *perft_worker (void *arg)
+{
+    struct perft_job *job = arg;
+    struct position position = job->root;
+
+    int i;
+    while ((i = __atomic_fetch_add (&job->next, 1, __ATOMIC_RELAXED))
+        < job->count) {
+        move_piece (&position, job->moves[i]);
+        job->leaves[i] = perft (&position, opponent_player (job->player),
+            job->depth - 1);
+        unmove_piece (&position, job->moves[i]);
+    }
+    return NULL;
+}
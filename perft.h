@@ -0,0 +1,28 @@
+#define PERFT_MAX_THREADS   64
+
+/* Subtree counts found by perft, keyed by position. The data word packs the
+ * count (bits 8 - 63) and the depth searched (bits 0 - 7), and is checked
+ * against the position's key the way struct tt_entry is, so threads share
+ * the table without locking.  */
+struct perft_entry {
+    uint64_t check;
+    uint64_t data;
+};
+
+/* Work shared by the threads of one perft_divide. Each thread counts on its
+ * own copy of ROOT. NEXT is the next of the COUNT root MOVES to be
+ * counted.  */
+struct perft_job {
+    struct position root;
+    int   player;
+    int   depth;
+    int  *moves;
+    long *leaves;
+    int   count;
+    int   next;
+};
+
+int   perft_hash_init (int);
+long  perft (struct position *, int, int);
+void  perft_divide (struct position *, int, int, int *, long *, int, int);
+void *perft_worker (void *);
@@ -0,0 +1,80 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* Nothing here is built unless tracing is enabled.  */
+#ifdef TRACE_ENABLED
+
+/* Messages are formatted into a buffer belonging to the calling thread and
+ * only written to TRACE_FILE when it fills up, or on trace_flush. Each flush
+ * is a single fwrite, so lines from different threads never interleave.
+ * Every thread's buffer is flushed as it exits, by trace_key's destructor,
+ * and the main thread's at exit.  */
+static __thread char trace_buf[TRACE_BUF_SIZE];
+static __thread int  trace_len;
+static FILE          *trace_fp;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  trace_key;
+
+/* Open TRACE_FILE, and arrange for each thread's buffer to be flushed when
+ * it exits. Run once, by whichever thread traces first.  */
+void trace_open ()
+{
+    trace_fp = fopen (TRACE_FILE, "w");
+    pthread_key_create (&trace_key, trace_thread_exit);
+    atexit (trace_flush);
+}
+
+/* Destructor of trace_key, called as a thread that has traced exits.  */
+void trace_thread_exit (void *unused)
+{
+    trace_flush ();
+}
+
+/* Append a line to the trace buffer, tagged with CATEGORY and formatted from
+ * FORMAT like printf.  */
+void trace_write (int category, const char *format, ...)
+{
+    char line[TRACE_LINE_SIZE];
+    const char *tag = (category == TRACE_EVAL) ? "eval"
+        : (category == TRACE_MOVEGEN) ? "movegen"
+        : (category == TRACE_SEARCH) ? "search" : "protocol";
+
+    /* The key's destructor only runs for threads that have set it.  */
+    pthread_once (&trace_once, trace_open);
+    if (pthread_getspecific (trace_key) == NULL) {
+        pthread_setspecific (trace_key, trace_buf);
+    }
+
+    int len = snprintf (line, sizeof (line), "%s: ", tag);
+    va_list args;
+    va_start (args, format);
+    len += vsnprintf (line + len, sizeof (line) - len - 1, format, args);
+    va_end (args);
+    if (len > (int) sizeof (line) - 2) {
+        len = sizeof (line) - 2;
+    }
+    line[len++] = '\n';
+
+    if (trace_len + len > TRACE_BUF_SIZE) {
+        trace_flush ();
+    }
+    memcpy (trace_buf + trace_len, line, len);
+    trace_len += len;
+}
+
+/* Write the calling thread's buffered messages to TRACE_FILE.  */
+void trace_flush ()
+{
+    if (trace_fp != NULL && trace_len > 0) {
+        fwrite (trace_buf, 1, trace_len, trace_fp);
+        fflush (trace_fp);
+    }
+    trace_len = 0;
+}
+
+#endif
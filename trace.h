@@ -0,0 +1,32 @@
+/* Debug tracing. Trace points compile to nothing unless TRACE_ENABLED is
+ * defined ("make trace"), so they cost nothing in a normal build and their
+ * arguments aren't even evaluated. TRACE_CATEGORIES can be defined to keep
+ * only some of the categories below.  */
+#define TRACE_EVAL      0x01
+#define TRACE_MOVEGEN   0x02
+#define TRACE_SEARCH    0x04
+#define TRACE_PROTOCOL  0x08
+
+#ifndef TRACE_CATEGORIES
+#define TRACE_CATEGORIES    0x0f
+#endif
+
+#define TRACE_FILE      "trace.txt"
+#define TRACE_BUF_SIZE  65536   /* Bytes buffered per thread.  */
+#define TRACE_LINE_SIZE 256     /* Longer messages are truncated.  */
+
+#ifdef TRACE_ENABLED
+#define TRACE(category, ...) \
+    do { \
+        if ((category) & TRACE_CATEGORIES) { \
+            trace_write ((category), __VA_ARGS__); \
+        } \
+    } while (0)
+#else
+#define TRACE(category, ...)    ((void) 0)
+#endif
+
+void trace_open ();
+void trace_thread_exit (void *);
+void trace_write (int, const char *, ...);
+void trace_flush ();
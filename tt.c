@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "tt.h"
+
+#define SCORE_OFFSET    (1 << 19)
+
+struct tt_bucket *tt_table;
+uint64_t tt_mask;
+int      tt_generation;
+
+/* Allocate a table of at most MEGABYTES, rounded down to a power of two
+ * buckets so a key's bucket is found with a mask. Returns FALSE if the memory
+ * isn't available, leaving the previous table in place.  */
+int tt_init (int megabytes)
+{
+    size_t buckets = 1;
+    while (buckets * 2 * sizeof (struct tt_bucket)
+        <= (size_t) megabytes << 20) {
+        buckets *= 2;
+    }
+
+    struct tt_bucket *table = aligned_alloc (64,
+        buckets * sizeof (struct tt_bucket));
+    if (table == NULL) {
+        return FALSE;
+    }
+
+    free (tt_table);
+    tt_table = table;
+    tt_mask  = buckets - 1;
+    tt_clear ();
+    return TRUE;
+}
+
+/* Forget every stored position.  */
+void tt_clear ()
+{
+    memset (tt_table, 0, (tt_mask + 1) * sizeof (struct tt_bucket));
+    tt_generation = 0;
+}
+
+/* Mark the start of a new search, so entries from earlier searches are
+ * preferred for replacement. Searches running side by side may share a
+ * generation.  */
+void tt_new_search ()
+{
+    int generation = __atomic_load_n (&tt_generation, __ATOMIC_RELAXED);
+    __atomic_store_n (&tt_generation, (generation + 1) & 63,
+        __ATOMIC_RELAXED);
+}
+
+/* Look up KEY. If found return TRUE and set *MOVE, *SCORE, *DEPTH and *BOUND
+ * from the entry.  */
+int tt_probe (uint64_t key, int *move, int *score, int *depth, int *bound)
+{
+    struct tt_entry *entry = tt_table[key & tt_mask].entries;
+
+    int i;
+    for (i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t data  = __atomic_load_n (&entry[i].data, __ATOMIC_RELAXED);
+        uint64_t check = __atomic_load_n (&entry[i].check, __ATOMIC_RELAXED);
+        if ((check ^ data) == key && data != 0) {
+            *move  = data & 0xffffff;
+            *score = (int) ((data >> 24) & 0xfffff) - SCORE_OFFSET;
+            *depth = (data >> 44) & 0xff;
+            *bound = (data >> 52) & 0x3;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Store the result of searching KEY to DEPTH. An entry for the same key is
+ * always overwritten, keeping its move if MOVE is 0. Otherwise the entry
+ * replaced is the shallowest, counting entries from older searches as
+ * shallower the older they are.  */
+void tt_store (uint64_t key, int move, int score, int depth, int bound)
+{
+    struct tt_entry *entry = tt_table[key & tt_mask].entries;
+    struct tt_entry *victim = &entry[0];
+    int victim_value = 1 << 30;
+    int generation = __atomic_load_n (&tt_generation, __ATOMIC_RELAXED);
+
+    int i;
+    for (i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t data  = __atomic_load_n (&entry[i].data, __ATOMIC_RELAXED);
+        uint64_t check = __atomic_load_n (&entry[i].check, __ATOMIC_RELAXED);
+        if ((check ^ data) == key) {
+            victim = &entry[i];
+            if (move == 0) {
+                move = data & 0xffffff;
+            }
+            break;
+        }
+
+        int age   = (generation - (int) (data >> 54)) & 63;
+        int value = (int) ((data >> 44) & 0xff) - 8 * age;
+        if (data == 0) {
+            value = -(1 << 30);
+        }
+        if (value < victim_value) {
+            victim = &entry[i];
+            victim_value = value;
+        }
+    }
+
+    uint64_t data = ((uint64_t) move & 0xffffff)
+        | ((uint64_t) (score + SCORE_OFFSET) << 24)
+        | ((uint64_t) depth << 44)
+        | ((uint64_t) bound << 52)
+        | ((uint64_t) generation << 54);
+    __atomic_store_n (&victim->data, data, __ATOMIC_RELAXED);
+    __atomic_store_n (&victim->check, key ^ data, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,29 @@
+/* Bound types stored with a transposition table score.  */
+#define TT_EXACT        0
+#define TT_LOWER        1   /* Search failed high, score is a lower bound.  */
+#define TT_UPPER        2   /* Search failed low, score is an upper bound.  */
+
+#define TT_DEFAULT_MB   16
+#define TT_BUCKET_SIZE  4
+
+/* An entry is one word packing the best move (bits 0 - 23), score (24 - 43,
+ * offset to be non-negative), depth (44 - 51), bound type (52 - 53) and the
+ * search generation that stored it (54 - 59), plus a check word holding the
+ * position key XORed with the data. Search threads share the table without
+ * locking: an entry torn by two threads writing at once fails the check and
+ * reads as a miss. Entries are grouped in buckets that share one cache
+ * line.  */
+struct tt_entry {
+    uint64_t check;
+    uint64_t data;
+};
+
+struct tt_bucket {
+    struct tt_entry entries[TT_BUCKET_SIZE];
+};
+
+int  tt_init (int);
+void tt_clear ();
+void tt_new_search ();
+int  tt_probe (uint64_t, int *, int *, int *, int *);
+void tt_store (uint64_t, int, int, int, int);